@@ -26,6 +26,7 @@ CFLAGS="
 -ffreestanding -nostdlib -Wall -Wextra -pedantic -O2 -m32
 -fno-pic -fno-pie -fno-stack-protector
 -I ./includes
+${EXTRA_CFLAGS}
 "
 
 LDFLAGS="-T ${LINKER_SCRIPT} -m elf_i386"
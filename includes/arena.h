@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN         8
+#define ARENA_DEFAULT_ORDER 1       // 8 KB chunks unless a request needs more
+
+// Header at the start of every page block owned by an arena
+struct arena_chunk {
+    struct arena_chunk *next;
+    uint32_t order;
+    uint32_t used;                  // Bytes consumed, including this header
+};
+
+struct arena {
+    struct arena_chunk *chunks;     // Current chunk first; the last one holds the arena
+    unsigned int order;
+};
+
+struct arena *arena_create(unsigned int order);
+void *arena_alloc(struct arena *arena, size_t size);
+void *arena_zalloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_destroy(struct arena *arena);
+
+#endif
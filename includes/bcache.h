@@ -0,0 +1,92 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <blk.h>
+
+/*
+ * Write-back buffer cache over the block layer. Buffers hold one
+ * page-sized group of sectors and are keyed by (drive, block), with
+ * block = lba / BCACHE_BLOCK_SECTORS. Lookup is hashed; eviction is CLOCK
+ * over the buffers in allocation order and never picks a pinned buffer.
+ *
+ * Writes only dirty the buffer. bcache_idle() writes back buffers that have
+ * been dirty for BCACHE_WRITEBACK_MS, and bcache_sync() writes back
+ * everything for a drive and then issues the cache flush barrier. Each
+ * buffer remembers which of its sectors are dirty, and writeback sends the
+ * span from the first to the last of them rather than the whole buffer.
+ *
+ * bcache_read() watches each drive for a sequential stream. Once two
+ * consecutive blocks confirm one, blocks ahead of the reader are queued as
+ * asynchronous reads. The window starts at BCACHE_RA_MIN sectors, doubles
+ * each time the reader catches up with it, up to BCACHE_RA_MAX or a quarter
+ * of the budget, and collapses again on the first non-sequential read.
+ */
+
+#define BCACHE_BLOCK_SECTORS    8
+#define BCACHE_BLOCK_SIZE       (BCACHE_BLOCK_SECTORS * BLK_SECTOR_SIZE)
+#define BCACHE_HASH_SIZE        256
+#define BCACHE_DEFAULT_BUDGET   (256u << 10)    // Bytes of buffer data
+#define BCACHE_WRITEBACK_MS     500
+#define BCACHE_RA_MIN           16      // Readahead window, sectors
+#define BCACHE_RA_MAX           512
+
+// Buffer flags
+#define BH_VALID    0x01
+#define BH_DIRTY    0x02
+
+struct buffer_head {
+    uint8_t  drive;
+    uint8_t  flags;
+    uint8_t  referenced;        // CLOCK second-chance bit
+    uint8_t  dirty_mask;        // Bit i: sector i written since the last writeback
+    uint16_t pins;              // bcache_get references plus bcache_pin holds
+    uint32_t block;
+    uint32_t sectors;           // Short for the last block of a drive
+    uint8_t *data;              // BCACHE_BLOCK_SIZE bytes, page aligned
+    uint64_t dirty_ns;          // When the buffer first became dirty
+    struct blk_request req;     // Writeback or readahead in flight
+    struct buffer_head *hash_next;
+    struct buffer_head *clock_next;
+};
+
+struct bcache_stream {
+    uint32_t next;              // Block a sequential reader asks for next
+    uint32_t ra_end;            // First block past the readahead queued so far
+    uint32_t window;            // Sectors
+    uint32_t seq;               // Consecutive sequential blocks seen
+};
+
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;        // Buffers written back
+    uint32_t writeback_runs;    // Timed writebacks that found work
+    uint32_t buffers;
+    uint32_t dirty;
+    uint32_t pinned;
+    uint32_t budget;            // Bytes
+    uint32_t ra_issued;         // Blocks queued by readahead
+    uint32_t ra_hits;           // ... later read or written
+    uint32_t ra_wasted;         // ... evicted unused or failed
+};
+
+struct buffer_head *bcache_get(uint8_t drive, uint32_t block);
+void bcache_put(struct buffer_head *bh);
+void bcache_mark_dirty(struct buffer_head *bh);
+
+int bcache_read(uint8_t drive, uint32_t lba, uint32_t count, void *buf);
+int bcache_write(uint8_t drive, uint32_t lba, uint32_t count, const void *buf);
+int bcache_pin(uint8_t drive, uint32_t lba, uint32_t count);
+void bcache_unpin(uint8_t drive, uint32_t lba, uint32_t count);
+
+int bcache_writeback(uint8_t drive);
+int bcache_sync(uint8_t drive);
+void bcache_idle(void);
+
+void bcache_set_budget(uint32_t bytes);
+void bcache_get_stats(struct bcache_stats *out);
+void bcache_dump_stats(void);
+
+#endif
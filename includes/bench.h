@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Boot-time benchmarks. kmain runs them when the kernel is built with
+ * EXTRA_CFLAGS=-DKERNEL_BENCH; results are written to COM1 as one
+ * "key=value" record per line.
+ */
+
+#include <stdint.h>
+
+void mem_bench(void);
+void ide_bench(uint8_t drive);
+int dir_bench(uint8_t drive);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <stdint.h>
+
+// Open-coded: the kernel does not link libgcc, which __builtin_popcount
+// needs on CPUs without POPCNT
+static inline uint32_t popcount32(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+    return (x * 0x01010101u) >> 24;
+}
+
+static inline uint32_t popcount64(uint64_t x) {
+    return popcount32((uint32_t)x) + popcount32((uint32_t)(x >> 32));
+}
+
+#endif
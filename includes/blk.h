@@ -0,0 +1,127 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include <stdint.h>
+
+/*
+ * Block I/O entry points used by filesystems. Writes land in the drive's
+ * volatile cache unless BLK_FUA is given; blk_flush() is the barrier that
+ * makes everything written before it durable. A flush with no writes since
+ * the previous one is skipped.
+ *
+ * Reads and plain writes go through a request queue per IDE channel.
+ * Pending requests are kept sorted by LBA and dispatched in C-LOOK order;
+ * requests that continue one another are merged into a single command with
+ * a scatter-gather list. With the channel IRQ enabled, commands run
+ * asynchronously and complete from the interrupt handler, so the two
+ * channels make progress independently. A request that overlaps a queued
+ * one, either of them a write, waits in blk_submit until that one has
+ * been issued, so overlapping writes land in submission order.
+ *
+ * Every drive number names a struct block_device. IDE drives are registered
+ * by blk_ide_init() under their ide_devices[] index and use the queue; other
+ * backends, such as RAM disks, complete each request synchronously through
+ * their ops.
+ */
+
+#define BLK_SECTOR_SIZE 512
+#define BLK_MAX_DRIVES  8       // IDE drives 0-3, other backends above
+#define BLK_RAMDISK_DRIVE 4
+
+// blk_write flags
+#define BLK_FUA         0x01    // Durable on return
+
+// Request operations and status
+#define BLK_READ        0
+#define BLK_WRITE       1
+#define BLK_PENDING     1
+
+#define BLK_CHANNELS    2
+#define BLKQ_MAX_SG     32      // Requests merged into one command
+
+struct blk_stats {
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t fua_writes;
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t flushes;           // Cache flushes sent to the drive
+    uint32_t flushes_coalesced; // blk_flush calls with nothing to flush
+};
+
+struct block_device;
+
+// Synchronous operations of a backend. count is not limited by max_sectors.
+struct block_device_ops {
+    int (*read)(struct block_device *dev, uint32_t lba, uint32_t count, void *buf);
+    int (*write)(struct block_device *dev, uint32_t lba, uint32_t count, const void *buf, uint32_t flags);
+    int (*flush)(struct block_device *dev);
+    uint32_t (*size)(struct block_device *dev);     // Sectors
+};
+
+struct block_device {
+    const char *name;
+    const struct block_device_ops *ops;
+    void *private;
+    uint8_t  drive;             // Set by blk_register
+    int8_t   channel;           // IDE channel whose queue serves it, or -1
+    uint32_t max_sectors;       // Largest single request
+};
+
+struct blk_request;
+typedef void (*blk_done_t)(struct blk_request *req);
+
+struct blk_request {
+    uint8_t  drive;
+    uint8_t  op;                // BLK_READ or BLK_WRITE
+    uint32_t lba;
+    uint32_t count;             // Sectors, at most blk_max_sectors(drive)
+    void    *buf;
+    blk_done_t done;            // Optional; runs in interrupt context when async
+    void    *private;
+
+    // Owned by the queue
+    volatile int status;        // BLK_PENDING until complete, then 0 or -1
+    uint64_t submit_ns;
+    struct blk_request *next;
+};
+
+struct blk_queue_stats {
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t errors;
+    uint32_t commands;          // Device commands issued
+    uint32_t merged;            // Requests carried by another request's command
+    uint32_t depth;             // Requests queued or in flight right now
+    uint32_t max_depth;
+    uint64_t depth_sum;         // Depth seen by each submit, for the mean
+    uint64_t latency_ns;        // Submit to completion, summed
+    uint64_t max_latency_ns;
+};
+
+int blk_register(uint8_t drive, struct block_device *dev);
+struct block_device *blk_device(uint8_t drive);
+uint32_t blk_size(uint8_t drive);
+
+int blk_read(uint8_t drive, uint32_t lba, uint32_t count, void *buf);
+int blk_write(uint8_t drive, uint32_t lba, uint32_t count, const void *buf, uint32_t flags);
+int blk_flush(uint8_t drive);
+void blk_get_stats(uint8_t drive, struct blk_stats *out);
+void blk_dump_stats(void);
+
+uint32_t blk_max_sectors(uint8_t drive);
+int blk_submit(struct blk_request *req);
+void blk_wait(struct blk_request *req);
+void blk_drain(uint8_t drive);
+
+// IDE request queue behind blk_submit, blk_wait and blk_drain
+int blkq_submit(struct blk_request *req);
+void blkq_wait(struct blk_request *req);
+void blkq_drain(uint8_t channel);
+void blk_queue_get_stats(uint8_t channel, struct blk_queue_stats *out);
+
+// Backends
+void blk_ide_init(void);
+int ramdisk_create(uint8_t drive, uint32_t sectors);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+/*
+ * TSC clocksource, calibrated against PIT channel 0 at boot. Until
+ * clock_init() has run (or on CPUs without a TSC) the delays fall back to
+ * port 0x80 writes, which take roughly a microsecond each.
+ */
+
+#define PIT_HZ              1193182
+#define CLOCK_CALIBRATE_MS  50
+
+void clock_init(void);
+uint32_t clock_tsc_khz(void);
+uint64_t ktime_ns(void);
+void ndelay(uint32_t ns);
+void udelay(uint32_t us);
+void clock_sleep_ns(uint64_t ns);
+
+static inline void mdelay(uint32_t ms) {
+    while (ms--) udelay(1000);
+}
+
+#endif
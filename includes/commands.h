@@ -109,6 +109,62 @@ static inline void mmio_write64(volatile void *addr, uint64_t value) {
     *(volatile uint64_t*)addr = value;
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid"
+                  : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                  : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    asm volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    asm volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    asm volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    asm volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    asm volatile ("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint32_t value) {
+    asm volatile ("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline void invlpg(uint32_t addr) {
+    asm volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
 // Memory barriers for ordering
 static inline void memory_barrier(void) {
     asm volatile ("mfence" ::: "memory");
@@ -126,4 +182,25 @@ static inline void compiler_barrier(void) {
     asm volatile ("" ::: "memory");
 }
 
+// Disable interrupts, returning the previous EFLAGS
+#define EFLAGS_IF (1u << 9)
+
+static inline unsigned long read_eflags(void) {
+    unsigned long flags;
+    asm volatile ("pushf; pop %0" : "=r"(flags));
+    return flags;
+}
+
+static inline unsigned long save_and_cli(void) {
+    unsigned long flags = read_eflags();
+    asm volatile ("cli" ::: "memory");
+    return flags;
+}
+
+// Restore flags if interrupts were enabled
+static inline void restore_flags(unsigned long flags) {
+    if (flags & EFLAGS_IF)
+        asm volatile ("sti" ::: "memory");
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// CPUID leaf 1, EDX
+#define CPUID_EDX_FPU   (1u << 0)
+#define CPUID_EDX_PSE   (1u << 3)
+#define CPUID_EDX_TSC   (1u << 4)
+#define CPUID_EDX_MSR   (1u << 5)
+#define CPUID_EDX_MTRR  (1u << 12)
+#define CPUID_EDX_PGE   (1u << 13)
+#define CPUID_EDX_PAT   (1u << 16)
+#define CPUID_EDX_FXSR  (1u << 24)
+#define CPUID_EDX_SSE   (1u << 25)
+#define CPUID_EDX_SSE2  (1u << 26)
+
+// CPUID leaf 1, ECX
+#define CPUID_ECX_SSE3  (1u << 0)
+#define CPUID_ECX_POPCNT (1u << 23)
+
+#define CR0_MP          (1u << 1)
+#define CR0_EM          (1u << 2)
+#define CR0_TS          (1u << 3)
+#define CR0_NE          (1u << 5)
+#define CR0_WP          (1u << 16)
+#define CR0_PG          (1u << 31)
+#define CR4_PSE         (1u << 4)
+#define CR4_PGE         (1u << 7)
+#define CR4_OSFXSR      (1u << 9)
+#define CR4_OSXMMEXCPT  (1u << 10)
+
+struct cpu_info {
+    uint32_t features_edx;
+    uint32_t features_ecx;
+    uint8_t  sse_enabled;
+    char     vendor[13];
+};
+
+extern struct cpu_info cpu;
+
+// Depth of hardware interrupt handlers currently running (see irq_handler)
+extern volatile uint32_t irq_nesting;
+
+void cpu_init(void);
+
+static inline int cpu_has(uint32_t edx_bit) {
+    return (cpu.features_edx & edx_bit) != 0;
+}
+
+/*
+ * SSE registers are not saved across interrupts, so vector code may only run
+ * outside interrupt handlers. Handlers never touch XMM state themselves, which
+ * keeps the registers of any interrupted mainline user intact.
+ */
+static inline int kernel_simd_usable(void) {
+    return cpu.sse_enabled && irq_nesting == 0;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <fs/elixir.h>
+
+/*
+ * Cache of directory entries in front of the on-disk hash directories.
+ * Entries are keyed by (drive, parent index, name), hashed into
+ * DCACHE_HASH_SIZE chains, and kept on an LRU list; once all
+ * DCACHE_ENTRIES are in use the least recently used one is reused.
+ * Only names that exist are cached.
+ */
+
+#define DCACHE_ENTRIES      1024
+#define DCACHE_HASH_SIZE    1024
+
+struct dentry {
+    uint8_t  drive;
+    uint8_t  len;               // 0 while unused
+    uint32_t parent;
+    uint32_t hash;              // elixir_name_hash of the name
+    uint32_t ino;
+    char     name[ELIXIR_NAME_MAX];
+    struct dentry *hash_next;
+    struct dentry *lru_prev;
+    struct dentry *lru_next;
+};
+
+struct dcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t entries;
+};
+
+uint32_t dcache_lookup(uint8_t drive, uint32_t parent, uint32_t hash, const char *name, uint32_t len);
+void dcache_add(uint8_t drive, uint32_t parent, uint32_t hash, const char *name, uint32_t len, uint32_t ino);
+void dcache_remove(uint8_t drive, uint32_t parent, uint32_t hash, const char *name, uint32_t len);
+void dcache_invalidate(uint8_t drive);
+void dcache_get_stats(struct dcache_stats *out);
+
+#endif
@@ -2,10 +2,22 @@
 #define ELIXIR_H
 
 #include <stdint.h>
+#include <arena.h>
 
 #define ELIXIR_SUPERBLOCK_LBA 1
 #define ELIXIR_BITMAP_START_LBA 2
 #define ELIXIR_MAGIC 0xE1F5
+#define ELIXIR_ROOT_INO 0
+#define ELIXIR_NAME_MAX 50
+
+// index types
+#define ELIXIR_TYPE_FILE 1
+#define ELIXIR_TYPE_DIR 2
+
+// s_state: set dirty at mount and clean again by elixir_unmount, so a clean
+// superblock's free counts can be trusted without rescanning the bitmap
+#define ELIXIR_STATE_CLEAN 1
+#define ELIXIR_STATE_DIRTY 2
 
 struct super_block {
     uint16_t s_magic;
@@ -23,28 +35,216 @@ struct super_block {
     uint8_t padding[474];
 } __attribute__((packed));
 
+// Free space summary over a run of bitmap bits: free bits at the start,
+// free bits at the end, and the longest free run anywhere inside
+struct free_run {
+    uint32_t pre;
+    uint32_t suf;
+    uint32_t best;
+};
+
+// One bit per filesystem block; bit i covers sectors
+// [i * sectors_per_block, (i + 1) * sectors_per_block)
 struct block_bitmap {
     uint32_t free_count;
     uint32_t used_count;
     uint32_t total;
     uint8_t *bitmap;
+    uint32_t *dirty;            // One bit per bitmap sector changed since the last write-out
+
+    // Allocation summary, built when the allocator first needs the bitmap
+    uint8_t *word_free;         // Free bits in each 32-bit bitmap word; full and empty
+                                // words skip the bit scan
+    struct free_run *runs;      // Tree over the words; node 1 covers the disk
+    uint32_t leaves;            // Words, rounded up to a power of two
 };
 
+#define ELIXIR_INLINE_EXTENTS 41
+#define ELIXIR_INLINE_DATA 496      // Bytes of a file kept in its index
+#define ELIXIR_EXTENT_MAGIC 0xE1E7
+
+// index flags
+#define ELIXIR_INDEX_INLINE 0x01    // data[] holds the file; no blocks mapped
+
+// count disk blocks from start, holding the file from block file_block on
+struct elixir_extent {
+    uint32_t file_block;
+    uint32_t start;
+    uint32_t count;
+} __attribute__((packed));
+
+/*
+ * One sector of the inode table. Files are mapped by a two-level extent
+ * tree. At depth 0, extents[] holds the extents themselves, sorted by
+ * file_block. Once they overflow, the file goes to depth 1: each entry
+ * points at a one-block extent_block, and its file_block is the first
+ * file block that block maps. Both levels are binary searched.
+ *
+ * A file of at most ELIXIR_INLINE_DATA bytes is kept in data[] instead,
+ * over the space the extents would use, and costs no data blocks. It moves
+ * to extents when a write takes it past that size and back again when it
+ * is truncated below it.
+ */
 struct index {
     uint8_t time_stamp;
     uint8_t type;
+    uint8_t flags;
+    uint8_t depth;
     uint32_t size;
-    uint32_t first_block;
-    uint8_t padding[504];
+    uint32_t blocks;            // File blocks mapped, always whole extents
+    uint16_t extent_count;      // Entries used in extents[]
+    uint16_t reserved;
+    union {
+        struct {
+            struct elixir_extent extents[ELIXIR_INLINE_EXTENTS];
+            uint8_t padding[4];
+        };
+        uint8_t data[ELIXIR_INLINE_DATA];
+    };
+} __attribute__((packed));
+
+// Overflow extents. Only the part of the block that fits in one cache
+// buffer is used, so the whole node is reached through one buffer_head.
+struct extent_block {
+    uint16_t magic;
+    uint16_t count;
+    uint32_t reserved;
+    struct elixir_extent extents[];
+} __attribute__((packed));
+
+/*
+ * A directory is a file holding a hash table of names. Sector 0 is a
+ * dir_header; bucket b is sector b + 1. A name lives in bucket
+ * hash & (buckets - 1), or, when that bucket is full, in the next one
+ * with room. A bucket that has ever been full is marked overflowed, and
+ * lookups stop at the first bucket that is not, so most names are found
+ * or ruled out by reading one bucket. The table doubles once it is three
+ * quarters full.
+ */
+#define ELIXIR_DIR_MAGIC 0xE1D1
+#define ELIXIR_DIR_MIN_BUCKETS 8
+#define ELIXIR_BUCKET_ENTRIES 8
+
+// dir_bucket flags
+#define ELIXIR_BUCKET_OVERFLOWED 0x01
+
+struct dir_entry {
+    uint32_t hash;
+    uint32_t ino;
+    uint8_t type;
+    uint8_t len;                // 0 for a free slot
+    char name[ELIXIR_NAME_MAX];
+} __attribute__((packed));
+
+struct dir_bucket {
+    uint8_t count;
+    uint8_t flags;
+    uint16_t reserved;
+    uint32_t reserved2;
+    struct dir_entry entries[ELIXIR_BUCKET_ENTRIES];
+    uint8_t padding[24];
+} __attribute__((packed));
+
+struct dir_header {
+    uint16_t magic;
+    uint16_t reserved;
+    uint32_t buckets;           // A power of two
+    uint32_t entries;
+    uint8_t padding[500];
 } __attribute__((packed));
 
-struct super_block* create_super(uint8_t drive);
-struct block_bitmap* create_bitmap(uint8_t drive);
-struct index* create_file(uint8_t drive);
+struct elixir_dir_stats {
+    uint32_t lookups;           // Lookups the dentry cache could not answer
+    uint32_t buckets_read;
+    uint32_t grows;
+};
+
+// Per-drive state of a mounted filesystem
+struct elixir_mount {
+    struct arena *arena;
+    struct super_block *sb;
+    struct block_bitmap *bb;    // Loaded on first allocation after a clean mount
+};
+
+static inline uint32_t elixir_sectors_per_block(const struct super_block *sb) {
+    return sb->s_block_size / 512;
+}
+
+// Bitmap sectors for a filesystem of total_blocks blocks
+static inline uint32_t elixir_bitmap_sectors(uint32_t total_blocks) {
+    return (total_blocks + 4095) / 4096;
+}
+
+/*
+ * In-memory structures are carved from a caller-supplied arena and are
+ * released together when the arena is reset or destroyed.
+ */
+struct super_block* create_super(struct arena *arena, uint8_t drive);
+struct block_bitmap* create_bitmap(struct arena *arena, struct super_block *sb);
+struct index* create_file(struct arena *arena, uint8_t drive);
 
 int elixir_format(uint8_t drive);
-int elixir_mount(uint8_t drive, struct super_block **sb_out);
-int elixir_write_bitmap(uint8_t drive, struct block_bitmap *bb);
-int elixir_read_bitmap(uint8_t drive, struct block_bitmap **bb_out);
+int elixir_mount(struct arena *arena, uint8_t drive, struct super_block **sb_out);
+int elixir_unmount(uint8_t drive);
+struct elixir_mount *elixir_get_mount(uint8_t drive);
+// Cached writes; the caller issues bcache_sync() when they must be durable
+int elixir_write_super(uint8_t drive, const struct super_block *sb);
+// Writes only the dirty bitmap sectors, one command per run of adjacent ones
+int elixir_write_bitmap(uint8_t drive, const struct super_block *sb, struct block_bitmap *bb);
+void elixir_bitmap_dirty(struct block_bitmap *bb, uint32_t start, uint32_t n);
+int elixir_read_bitmap(struct arena *arena, uint8_t drive, const struct super_block *sb,
+                       struct block_bitmap **bb_out);
+
+/*
+ * Extent allocation from the bitmap of a mounted drive. The search runs on
+ * the in-memory summary without disk I/O: per-word free counts at the
+ * bottom and a tree of free_run summaries above them, so a free run of any
+ * length is found in O(log n). alloc_extent returns the first block of a
+ * run of nblocks free blocks at or after hint, wrapping to the start of the
+ * disk, or UINT32_MAX. The bitmap sectors the change touched and the
+ * superblock's free count are written through the cache.
+ */
+uint32_t alloc_extent(uint8_t drive, uint32_t nblocks, uint32_t hint);
+int free_extent(uint8_t drive, uint32_t start, uint32_t nblocks);
+uint32_t alloc_max_run(uint8_t drive);
+
+/*
+ * File block mapping. elixir_bmap returns the disk block holding a file
+ * block, or UINT32_MAX past the end, and stores the blocks left in its
+ * extent in *run. elixir_extend appends nblocks, taking the longest runs
+ * the allocator has, starting right after the file's last block where
+ * possible. elixir_shrink frees blocks from the end. Neither applies to an
+ * inline file. The index is changed in memory only; extent blocks go
+ * through the cache.
+ */
+uint32_t elixir_bmap(uint8_t drive, const struct index *in, uint32_t file_block, uint32_t *run);
+int elixir_extend(uint8_t drive, struct index *in, uint32_t nblocks);
+int elixir_shrink(uint8_t drive, struct index *in, uint32_t nblocks);
+
+/*
+ * Byte I/O on a file of a mounted drive. Each contiguous piece of an
+ * extent is one cache request; inline files need no I/O beyond their
+ * index. Writes grow the file and zero any gap left before offset; the
+ * caller writes the index back with elixir_write_index.
+ */
+int elixir_read_index(uint8_t drive, uint32_t ino, struct index *in);
+int elixir_write_index(uint8_t drive, uint32_t ino, const struct index *in);
+int elixir_file_read(uint8_t drive, const struct index *in, uint32_t offset, void *buf, uint32_t len);
+int elixir_file_write(uint8_t drive, struct index *in, uint32_t offset, const void *buf, uint32_t len);
+int elixir_file_truncate(uint8_t drive, struct index *in, uint32_t size);
+
+/*
+ * Directories, by index number. Names are 1 to ELIXIR_NAME_MAX bytes
+ * without '/' and are answered from the dentry cache when possible.
+ * elixir_lookup and elixir_namei return an index number or UINT32_MAX.
+ * Unlinking removes the name only; there is no index allocator yet to
+ * give the index back to.
+ */
+uint32_t elixir_name_hash(const char *name, uint32_t len);
+uint32_t elixir_lookup(uint8_t drive, uint32_t dir, const char *name, uint32_t len);
+int elixir_link(uint8_t drive, uint32_t dir, const char *name, uint32_t len, uint32_t ino, uint8_t type);
+int elixir_unlink(uint8_t drive, uint32_t dir, const char *name, uint32_t len);
+uint32_t elixir_namei(uint8_t drive, const char *path);
+void elixir_dir_get_stats(struct elixir_dir_stats *out);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef HEAP_PROFILE_H
+#define HEAP_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HEAP_PROFILE_SITES      64
+#define HEAP_PROFILE_BUCKETS    20      // Request sizes <= 16, 32, ... 4M, larger
+
+struct heap_site {
+    uintptr_t addr;                     // Return address of the kmalloc/kzalloc caller
+    uint32_t allocs;
+    uint32_t bytes;                     // Requested bytes, cumulative
+};
+
+struct heap_profile {
+    uint32_t live_bytes;                // Usable bytes currently handed out
+    uint32_t peak_bytes;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t requested_bytes;           // Cumulative, as asked for
+    uint32_t usable_bytes;              // Cumulative, after size-class rounding
+    uint32_t untracked;                 // Allocations from sites past a full table
+    uint32_t histogram[HEAP_PROFILE_BUCKETS];
+    struct heap_site sites[HEAP_PROFILE_SITES];
+};
+
+void heap_profile_alloc(size_t requested, size_t usable, void *site);
+void heap_profile_free(size_t usable);
+void heap_profile_dump(void);
+
+#endif
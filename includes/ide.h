@@ -73,16 +73,125 @@
 #define ATA_CMD_PACKET            0xA0
 #define ATA_CMD_IDENTIFY_PACKET   0xA1
 #define ATA_CMD_IDENTIFY          0xEC
+#define ATA_CMD_READ_MULTIPLE     0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE      0xC6
+#define ATA_CMD_SET_FEATURES      0xEF
+#define ATA_CMD_WRITE_DMA_FUA_EXT 0x3D
+#define ATA_CMD_WRITE_MULTIPLE_FUA_EXT 0xCE
+
+// SET FEATURES subcommands and transfer mode values
+#define ATA_FEAT_XFER_MODE  0x03
+#define ATA_XFER_PIO_FLOW   0x08    // | PIO mode number
+#define ATA_XFER_MWDMA      0x20    // | multiword DMA mode number
+#define ATA_XFER_UDMA       0x40    // | Ultra DMA mode number
+
+// IDENTIFY word offsets
+#define ATA_IDENT_DEVICETYPE    0
+#define ATA_IDENT_MAX_MULTIPLE  47
+#define ATA_IDENT_CAPABILITIES  49
+#define ATA_IDENT_FIELD_VALID   53
+#define ATA_IDENT_MWDMA         63
+#define ATA_IDENT_PIO_MODES     64
+#define ATA_IDENT_UDMA          88
+
+// Word 53 bits
+#define ATA_VALID_64_70     0x0002
+#define ATA_VALID_88        0x0004
+
+// Sectors per DRQ block requested with SET MULTIPLE
+#define IDE_MULTIPLE_MAX    16
+
+// Device control register bits
+#define ATA_CTRL_NIEN       0x02    // Mask the drive interrupt
+#define ATA_CTRL_SRST       0x04
+#define ATA_CTRL_HOB        0x80    // Read back the high-order LBA48 bytes
+
+// Legacy channel interrupts
+#define IDE_IRQ_PRIMARY     14
+#define IDE_IRQ_SECONDARY   15
+#define IDE_IRQ_TIMEOUT_MS  1000    // Before falling back to polling
+#define IDE_DMA_POLL_LOOPS  1000000 // Status reads before a DMA command has failed; the
+                                    // clock may not run, so this is not a time
+
+// Settle time after selecting a drive or writing a command
+#define ATA_SETTLE_NS       400
+
+// Bus master IDE registers, relative to channels[].bmide
+#define ATA_BM_COMMAND      0x00
+#define ATA_BM_STATUS       0x02
+#define ATA_BM_PRDT         0x04
+
+// Bus master command bits
+#define ATA_BM_CMD_START    0x01
+#define ATA_BM_CMD_READ     0x08    // Device to memory
+
+// Bus master status bits
+#define ATA_BM_SR_ACTIVE    0x01
+#define ATA_BM_SR_ERR       0x02
+#define ATA_BM_SR_IRQ       0x04
+#define ATA_BM_SR_DRV0_DMA  0x20
+#define ATA_BM_SR_DRV1_DMA  0x40
+
+// Physical region descriptors
+#define IDE_PRD_EOT         0x8000
+#define IDE_PRD_MAX         (4096 / sizeof(struct ide_prd))
+#define IDE_PRD_BOUNDARY    0x10000     // A region may not cross 64 KB
+#define IDE_DMA_MAX_SECTORS ((IDE_PRD_MAX - 1) * (IDE_PRD_BOUNDARY / 512))
+
+// First sector LBA28 cannot address
+#define ATA_LBA28_LIMIT     0x10000000
+
+// IDENTIFY words 82-83, as stored in CommandSets: 48-bit address feature set
+#define ATA_CMDSET_LBA48    (1u << 26)
+
+// IDENTIFY word 84: WRITE DMA/MULTIPLE FUA EXT supported
+#define ATA_IDENT_CMDSET_EXT    84
+#define ATA_CMDSET_EXT_FUA      0x0040
+
+// Transfer directions for the internal transfer helpers
+#define IDE_OP_READ         0
+#define IDE_OP_WRITE        1
+#define IDE_OP_WRITE_FUA    2   // Durable on return; needs LBA48 commands
+
+// IDENTIFY word 49: DMA supported
+#define ATA_CAP_DMA         0x0100
 
 /* ============================================================================
  * DATA STRUCTURES
  * ============================================================================ */
 
+struct pci_device;
+
+struct ide_prd {
+    uint32_t addr;      // Physical buffer address
+    uint16_t count;     // Byte count, 0 means 64 KB
+    uint16_t flags;
+} __attribute__((packed));
+
+// Scatter-gather entry for a transfer built from several buffers
+struct ide_sg {
+    void    *buf;
+    uint32_t sectors;
+};
+
 struct ide_channel {
     uint16_t base;      // I/O Base
     uint16_t ctrl;      // Control Base
     uint16_t bmide;     // Bus Master IDE
     uint8_t  nIEN;      // No Interrupt
+    struct ide_prd *prdt;   // Page-aligned PRD table when bmide is set
+
+    // Completion state, written by the IRQ handler
+    volatile uint8_t irq_fired;
+    volatile uint8_t irq_status;
+    volatile uint8_t irq_bm_status;
+    uint32_t irq_count;
+    uint32_t irq_timeouts;
+    uint64_t sleep_cycles;  // TSC cycles spent halted waiting for the drive
+    void (*irq_hook)(uint8_t channel);  // Owner of an asynchronous command
 };
 
 struct ide_device {
@@ -93,8 +202,18 @@ struct ide_device {
     uint16_t Signature;      // Drive Signature
     uint16_t Capabilities;   // Features
     uint32_t CommandSets;    // Supported Command Sets
-    uint32_t Size;           // Size in Sectors
+    uint32_t Size;           // Size in Sectors (LBA48 sizes capped at 2^32 - 1)
     char     Model[41];      // Model in string
+    uint8_t  Dma;            // Transfers go through bus-master DMA
+    uint8_t  Lba48;          // Drive accepts the 48-bit EXT commands
+    uint8_t  Fua;            // Drive has the FUA EXT write commands
+    uint8_t  MultipleMax;    // Largest READ/WRITE MULTIPLE block (word 47)
+    uint8_t  Multiple;       // Sectors per DRQ block in use, 0 if off
+    uint8_t  PioModes;       // Supported PIO modes, bit n = mode n
+    uint8_t  MwdmaModes;     // Supported multiword DMA modes (word 63)
+    uint8_t  UdmaModes;      // Supported Ultra DMA modes (word 88)
+    uint8_t  PioMode;        // SET FEATURES values in effect, 0 if unset
+    uint8_t  DmaMode;
 };
 
 /* ============================================================================
@@ -113,13 +232,38 @@ uint8_t ide_polling(uint8_t channel, uint8_t advanced_check);
 uint8_t ide_read(uint8_t channel, uint8_t reg);
 void ide_initialize(void);
 void ide_identify(uint8_t channel, uint8_t drive);
-void ide_wait_irq(uint8_t channel);
+void ide_configure(uint8_t drive);
+uint8_t ide_wait_irq(uint8_t channel);
+uint8_t ide_wait(uint8_t channel, uint8_t advanced_check);
+void ide_irq_arm(uint8_t channel);
+void ide_set_irq(uint8_t channel, int enable);
 void ide_read_buffer(uint8_t channel, uint8_t reg, void *buffer, uint32_t quads);
 void ide_write(uint8_t channel, uint8_t reg, uint8_t data);
 void ide_delay(uint8_t channel);
-int ide_read_sectors(uint8_t drive, uint8_t numsects, uint32_t lba, void *buf);
+int ide_read_sectors(uint8_t drive, uint32_t numsects, uint32_t lba, void *buf);
 int ide_write_sectors_counted(uint8_t drive, uint32_t start_lba, size_t byte_count, const void *buf);
+int ide_write_sectors_fua(uint8_t drive, uint32_t start_lba, size_t byte_count, const void *buf);
+int ide_flush_cache(uint8_t drive);
+void ide_dma_init(void);
+int ide_piix_init(const struct pci_device *dev);
+int ide_piix_present(void);
+uint8_t ide_piix_udma_modes(void);
+int ide_piix_mwdma_pio(int mwdma);
+void ide_piix_set_modes(uint8_t drive, int pio, uint8_t dma);
+int ide_dma_usable(uint8_t drive, const void *buf, uint32_t bytes);
+int ide_dma_usable_sg(uint8_t drive, const struct ide_sg *sg, int nsg);
+int ide_dma_start(uint8_t drive, uint8_t op, uint32_t lba, const struct ide_sg *sg, int nsg);
+int ide_dma_busy(uint8_t drive);
+int ide_dma_finish(uint8_t drive, uint8_t op);
+int ide_pio_command(uint8_t drive, uint8_t op, uint32_t lba, uint32_t numsects);
+int ide_dma_transfer(uint8_t drive, uint8_t op, uint32_t lba, uint32_t numsects, void *buf);
+uint32_t ide_max_sectors(uint8_t drive);
+int ide_select_lba(uint8_t drive, uint32_t lba, uint32_t numsects, int lba48);
 uint64_t read_total_sectors(uint8_t drive_num);
-uint32_t find_next_free_lba(uint8_t drive);
+
+// Sectors per DRQ block for PIO transfers
+static inline uint32_t ide_pio_block(uint8_t drive) {
+    return ide_devices[drive].Multiple ? ide_devices[drive].Multiple : 1;
+}
 
 #endif // IDE_H
\ No newline at end of file
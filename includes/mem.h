@@ -4,15 +4,58 @@
 #include <stddef.h>
 #include <stdint.h>
 
-typedef struct free_list_block {
-    size_t size;
-    struct free_list_block *next;
-} free_list_block;
+#define HEAP_TAG_USED       0x1u
+#define HEAP_MAGIC          0xB10CB10Cu
+#define HEAP_HEADER_SIZE    8
+#define HEAP_FOOTER_SIZE    4
+#define HEAP_MIN_BLOCK      ((HEAP_HEADER_SIZE + 2 * sizeof(void *) + HEAP_FOOTER_SIZE + 7) & ~7u)
 
-void init_allocator_region(uint32_t region_base, uint32_t region_size);
+#define HEAP_INITIAL_ORDER  8   // First heap region: 1 MB of pages
+#define HEAP_GROW_ORDER     4   // Grow by at least 64 KB at a time
+
+/*
+ * Boundary-tagged heap block. The header (size + magic) is mirrored by a
+ * footer holding the size at the end of the block, so both neighbours can
+ * be found in O(1). The free-list links overlay the payload while free.
+ */
+typedef struct heap_block {
+    uint32_t size;              // Whole block including tags, bit 0 = in use
+    uint32_t magic;
+    struct heap_block *next;
+    struct heap_block *prev;
+} heap_block;
+
+enum heap_policy {
+    HEAP_FIRST_FIT = 0,
+    HEAP_NEXT_FIT  = 1,
+    HEAP_BEST_FIT  = 2
+};
+
+struct heap_stats {
+    uint32_t policy;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;
+    uint32_t splits;
+    uint32_t coalesces;
+    uint32_t grows;             // Regions added from the page allocator
+    uint32_t search_steps;      // Free blocks examined while searching for a fit
+    uint32_t free_blocks;
+    uint32_t free_bytes;
+    uint32_t largest_free;
+    uint32_t frag_permille;     // 1000 * (1 - largest_free / free_bytes)
+};
+
+void heap_init(void);
+
+void heap_set_policy(enum heap_policy policy);
+void heap_get_stats(struct heap_stats *out);
+int heap_check(void);
 
 void *kmalloc(size_t size);
+void *kzalloc(size_t size);
 void kfree(void *ptr);
+size_t ksize(const void *ptr);
 void *memcpy(void *restrict dest, const void *restrict src, size_t n);
 void *memset(void *s, int c, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
@@ -0,0 +1,25 @@
+#ifndef MEMOPS_H
+#define MEMOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Copies at or above this size bypass the cache with streaming stores
+#define MEMOPS_NT_THRESHOLD (256 * 1024)
+
+struct memops_variant {
+    const char *name;
+    uint32_t required_edx;      // CPUID leaf 1 EDX bits needed, 0 for none
+    void *(*copy)(void *dest, const void *src, size_t n);
+    void *(*set)(void *s, int c, size_t n);
+    int (*cmp)(const void *s1, const void *s2, size_t n);
+};
+
+extern const struct memops_variant memops_variants[];
+extern const int memops_variant_count;
+
+void memops_init(void);
+int memops_variant_usable(const struct memops_variant *v);
+const struct memops_variant *memops_active(void);
+
+#endif
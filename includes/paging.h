@@ -0,0 +1,44 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define LARGE_PAGE_SIZE     0x00400000          // 4 MB PSE page
+#define LOW_MAP_END         LARGE_PAGE_SIZE     // First 4 MB use 4 KB pages
+
+// Page directory / table entry bits
+#define PTE_PRESENT     0x001
+#define PTE_WRITE       0x002
+#define PTE_USER        0x004
+#define PTE_PWT         0x008
+#define PTE_PCD         0x010
+#define PTE_ACCESSED    0x020
+#define PTE_DIRTY       0x040
+#define PTE_PAT         0x080       // 4 KB entries only
+#define PDE_LARGE       0x080       // PS bit: entry maps a 4 MB page
+#define PTE_GLOBAL      0x100
+#define PDE_LARGE_PAT   0x1000      // PAT bit of a 4 MB entry
+
+#define MSR_IA32_PAT    0x277
+
+// PAT memory types
+#define PAT_UC          0x00
+#define PAT_WC          0x01
+#define PAT_WT          0x04
+#define PAT_WP          0x05
+#define PAT_WB          0x06
+#define PAT_UC_MINUS    0x07
+
+#define VGA_TEXT_BASE   0x000B8000
+#define VGA_TEXT_SIZE   0x00008000
+
+enum page_cache {
+    PAGE_CACHE_WB,
+    PAGE_CACHE_WC,          // Needs PAT; falls back to uncached without it
+    PAGE_CACHE_UC
+};
+
+void paging_init(void);
+int paging_set_cache(uint32_t addr, uint32_t size, enum page_cache mode);
+
+#endif
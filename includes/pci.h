@@ -0,0 +1,63 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+/* ============================================================================
+ * CONSTANTS
+ * ============================================================================ */
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS  0xCF8
+#define PCI_CONFIG_DATA     0xCFC
+
+// Configuration space offsets
+#define PCI_VENDOR_ID       0x00
+#define PCI_DEVICE_ID       0x02
+#define PCI_COMMAND         0x04
+#define PCI_STATUS          0x06
+#define PCI_PROG_IF         0x09
+#define PCI_SUBCLASS        0x0A
+#define PCI_CLASS           0x0B
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_BAR4            0x20
+#define PCI_INTERRUPT_LINE  0x3C
+
+// Command register bits
+#define PCI_COMMAND_IO      0x0001
+#define PCI_COMMAND_MEMORY  0x0002
+#define PCI_COMMAND_MASTER  0x0004
+
+#define PCI_BAR_IO          0x01
+#define PCI_HEADER_MULTI    0x80
+
+// Class codes
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+
+/* ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================ */
+
+struct pci_device {
+    uint8_t  bus;
+    uint8_t  slot;
+    uint8_t  func;
+    uint8_t  prog_if;
+    uint16_t vendor;
+    uint16_t device;
+};
+
+/* ============================================================================
+ * FUNCTIONS
+ * ============================================================================ */
+
+uint32_t pci_read32(const struct pci_device *dev, uint8_t offset);
+uint16_t pci_read16(const struct pci_device *dev, uint8_t offset);
+uint8_t pci_read8(const struct pci_device *dev, uint8_t offset);
+void pci_write32(const struct pci_device *dev, uint8_t offset, uint32_t value);
+void pci_write16(const struct pci_device *dev, uint8_t offset, uint16_t value);
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device *out);
+
+#endif // PCI_H
@@ -0,0 +1,79 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PAGE_SHIFT      12
+#define PAGE_SIZE       (1u << PAGE_SHIFT)
+#define MAX_ORDER       10      // Largest buddy block: 4 MB
+
+// BIOS memory map, collected by the bootloader before entering protected mode
+#define E820_MAP_ADDR       0x8000
+#define E820_MAX_ENTRIES    128
+#define E820_USABLE         1
+
+// Memory to assume when the BIOS provides no map
+#define PMM_FALLBACK_TOP    0x01000000
+
+// Page flags
+#define PG_RESERVED     0x01
+#define PG_FREE         0x02    // Head of a free buddy block
+#define PG_SLAB         0x04
+#define PG_HEAP         0x08
+#define PG_LARGE        0x10    // Page-backed kzalloc block
+#define PG_ZEROED       0x20    // Parked in the pre-zeroed pool
+
+// Pre-zeroed blocks kept ready by the idle loop, per order
+#define ZERO_POOL_MAX_ORDER 4
+#define ZERO_POOL_DEPTH     4
+
+struct e820_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t acpi;
+} __attribute__((packed));
+
+struct e820_map {
+    uint32_t count;
+    struct e820_entry entries[E820_MAX_ENTRIES];
+} __attribute__((packed));
+
+struct page {
+    uint8_t flags;
+    uint8_t order;              // Block order while PG_FREE
+    uint8_t slab_class;         // Owning size class while PG_SLAB
+    uint8_t reserved;
+    struct page *next;          // Free-area links
+    struct page *prev;
+};
+
+struct pmm_stats {
+    uint32_t total_pages;
+    uint32_t free_pages;
+    uint32_t free_blocks[MAX_ORDER + 1];
+    uint32_t zero_pool_blocks[ZERO_POOL_MAX_ORDER + 1];
+    uint32_t zero_pool_hits;
+    uint32_t zero_pool_misses;
+};
+
+void pmm_init(void);
+void pmm_init_map(const struct e820_entry *entries, uint32_t count);
+void *alloc_pages(unsigned int order);
+void free_pages(void *addr, unsigned int order);
+void *alloc_zeroed_pages(unsigned int order);
+void pmm_idle(void);
+struct page *virt_to_page(const void *addr);
+void pmm_get_stats(struct pmm_stats *out);
+uint32_t pmm_top(void);
+
+// Smallest order holding size bytes, or MAX_ORDER + 1, which alloc_pages
+// refuses, when no block is that large
+static inline unsigned int size_to_order(size_t size) {
+    unsigned int order = 0;
+    while (order <= MAX_ORDER && (PAGE_SIZE << order) < size) order++;
+    return order;
+}
+
+#endif
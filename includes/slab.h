@@ -0,0 +1,32 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size classes: 16, 32, 64, ... 2048 bytes
+#define SLAB_MIN_SHIFT   4
+#define SLAB_MAX_SHIFT   11
+#define SLAB_MIN_SIZE    (1u << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE    (1u << SLAB_MAX_SHIFT)
+#define SLAB_CLASSES     (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+struct slab_object {
+    struct slab_object *next;
+};
+
+struct slab_class {
+    uint32_t size;
+    uint32_t pages;             // Pages handed to this class so far
+    uint32_t in_use;            // Live objects
+    struct slab_object *free;   // Per-class free list
+};
+
+void slab_init(void);
+void *slab_alloc(size_t size);
+void slab_free(void *ptr);
+int slab_owns(const void *ptr);
+size_t slab_size(const void *ptr);
+void slab_get_stats(struct slab_class out[SLAB_CLASSES]);
+
+#endif
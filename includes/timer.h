@@ -2,6 +2,9 @@
 #define TIMER_H
 
 #include <stdint.h>
+#include <clock.h>
+
+#define TIMER_HZ 100
 
 void on_irq0(void);
 
@@ -11,19 +14,18 @@ void init_timer(void);
 
 uint64_t get_timer_ticks(void);
 
+// Waits of at least the requested time, timed by the clocksource rather
+// than rounded to whole ticks
 static inline void timer_wait_micros(uint32_t microseconds) {
-    if (microseconds == 0) return;
-    
-    uint32_t ticks = (microseconds + 9999) / 10000;
-    timer_wait(ticks);
+    clock_sleep_ns((uint64_t)microseconds * 1000);
 }
 
 static inline void timer_wait_ms(uint32_t milliseconds) {
-    timer_wait(milliseconds / 10);
+    clock_sleep_ns((uint64_t)milliseconds * 1000000);
 }
 
 static inline void timer_wait_seconds(uint32_t seconds) {
-    timer_wait(seconds * 100);
+    clock_sleep_ns((uint64_t)seconds * 1000000000);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <arena.h>
+#include <pmm.h>
+#include <mem.h>
+#include <vga.h>
+
+#define CHUNK_HEADER_SIZE ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+static struct arena_chunk *chunk_alloc(unsigned int order) {
+    struct arena_chunk *chunk = alloc_pages(order);
+    if (!chunk) return NULL;
+
+    chunk->next = NULL;
+    chunk->order = order;
+    chunk->used = CHUNK_HEADER_SIZE;
+    return chunk;
+}
+
+struct arena *arena_create(unsigned int order) {
+    struct arena_chunk *chunk = chunk_alloc(order);
+    if (!chunk) {
+        printf("arena_create: out of memory\n");
+        return NULL;
+    }
+
+    // The arena itself lives in its first chunk
+    struct arena *arena = (struct arena *)((uint8_t *)chunk + chunk->used);
+    chunk->used += (sizeof(struct arena) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena->chunks = chunk;
+    arena->order = order;
+    return arena;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    if (!arena || size == 0 || size > (PAGE_SIZE << MAX_ORDER)) return NULL;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    struct arena_chunk *chunk = arena->chunks;
+    if (chunk->used + size > (PAGE_SIZE << chunk->order)) {
+        unsigned int order = size_to_order(size + CHUNK_HEADER_SIZE);
+        if (order < arena->order) order = arena->order;
+
+        chunk = chunk_alloc(order);
+        if (!chunk) {
+            printf("arena_alloc: out of memory for %u bytes\n", size);
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void *ptr = (uint8_t *)chunk + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void *arena_zalloc(struct arena *arena, size_t size) {
+    void *ptr = arena_alloc(arena, size);
+    if (ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+// Release every chunk but the one holding the arena, and rewind it
+void arena_reset(struct arena *arena) {
+    if (!arena) return;
+
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk->next) {
+        struct arena_chunk *next = chunk->next;
+        free_pages(chunk, chunk->order);
+        chunk = next;
+    }
+
+    chunk->used = (uint32_t)((uint8_t *)arena - (uint8_t *)chunk) +
+                  ((sizeof(struct arena) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1));
+    arena->chunks = chunk;
+}
+
+void arena_destroy(struct arena *arena) {
+    if (!arena) return;
+
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk) {
+        struct arena_chunk *next = chunk->next;
+        free_pages(chunk, chunk->order);
+        chunk = next;
+    }
+}
@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <bench.h>
+#include <blk.h>
+#include <bcache.h>
+#include <clock.h>
+#include <mem.h>
+#include <serial.h>
+#include <fs/elixir.h>
+#include <fs/dcache.h>
+
+#define DIRBENCH_ENTRIES    100000
+#define DIRBENCH_LOOKUPS    20000
+#define DIRBENCH_HOT        256         // Names in the warm lookup set
+#define DIRBENCH_DIR_INO    1
+#define DIRBENCH_NAME       7           // Offset of the name in the path
+
+// Nanoseconds per operation without 64-bit division
+static uint32_t ns_per_op(uint64_t ns, uint32_t ops) {
+    while (ns > 0xFFFFFFFFull) {
+        ns >>= 1;
+        ops >>= 1;
+    }
+    return ops ? (uint32_t)ns / ops : 0;
+}
+
+// "/bench/f<i>"; returns the length of the name
+static uint32_t bench_path(char *buf, uint32_t i) {
+    char digits[10];
+    uint32_t n = 0;
+
+    memcpy(buf, "/bench/f", 8);
+    do {
+        digits[n++] = (char)('0' + i % 10);
+        i /= 10;
+    } while (i);
+
+    for (uint32_t k = 0; k < n; k++) buf[8 + k] = digits[n - 1 - k];
+    buf[8 + n] = '\0';
+    return n + 1;
+}
+
+static uint32_t bench_rng = 0x2545F491u;
+
+static uint32_t bench_rnd(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 17;
+    bench_rng ^= bench_rng << 5;
+    return bench_rng;
+}
+
+// Build a directory of DIRBENCH_ENTRIES names under /bench, then time path
+// lookups with a cold and a warm dentry cache, and unlink everything. The
+// names point at existing indexes in turn; only the directory is measured.
+int dir_bench(uint8_t drive) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    struct elixir_dir_stats start, d0, d1;
+    struct dcache_stats c0, c1;
+    struct blk_stats b0, b1;
+    struct index dir;
+    char path[24];
+    uint32_t failed = 0;
+
+    if (!m) return -1;
+    uint32_t inodes = m->sb->s_total_inodes;
+
+    elixir_dir_get_stats(&start);
+    memset(&dir, 0, sizeof(dir));
+    dir.type = ELIXIR_TYPE_DIR;
+    if (elixir_write_index(drive, DIRBENCH_DIR_INO, &dir) != 0 ||
+        elixir_link(drive, ELIXIR_ROOT_INO, "bench", 5, DIRBENCH_DIR_INO, ELIXIR_TYPE_DIR) != 0) {
+        serial_printf("dirbench drive=%u error=setup\n", drive);
+        return -1;
+    }
+
+    uint64_t t0 = ktime_ns();
+    for (uint32_t i = 0; i < DIRBENCH_ENTRIES; i++) {
+        uint32_t len = bench_path(path, i);
+        if (elixir_link(drive, DIRBENCH_DIR_INO, path + DIRBENCH_NAME, len, i % inodes, ELIXIR_TYPE_FILE) != 0) {
+            serial_printf("dirbench drive=%u error=create entry=%u\n", drive, i);
+            return -1;
+        }
+    }
+    uint64_t t1 = ktime_ns();
+
+    // Cold: random names, almost none of them in the dentry cache
+    dcache_invalidate(drive);
+    elixir_dir_get_stats(&d0);
+    blk_get_stats(drive, &b0);
+    uint64_t t2 = ktime_ns();
+    for (uint32_t i = 0; i < DIRBENCH_LOOKUPS; i++) {
+        uint32_t n = bench_rnd() % DIRBENCH_ENTRIES;
+        bench_path(path, n);
+        if (elixir_namei(drive, path) != n % inodes) failed++;
+    }
+    uint64_t t3 = ktime_ns();
+    blk_get_stats(drive, &b1);
+    elixir_dir_get_stats(&d1);
+
+    // Warm: a small working set that stays in the dentry cache
+    dcache_get_stats(&c0);
+    uint64_t t4 = ktime_ns();
+    for (uint32_t i = 0; i < DIRBENCH_LOOKUPS; i++) {
+        uint32_t n = i % DIRBENCH_HOT;
+        bench_path(path, n);
+        if (elixir_namei(drive, path) != n % inodes) failed++;
+    }
+    uint64_t t5 = ktime_ns();
+    dcache_get_stats(&c1);
+
+    uint32_t misses = d1.lookups - d0.lookups;
+    uint32_t buckets_per_component = misses ? (d1.buckets_read - d0.buckets_read) * 1000 / misses : 0;
+    uint32_t reads_per_path = (b1.reads - b0.reads) * 1000 / DIRBENCH_LOOKUPS;
+
+    uint64_t t6 = ktime_ns();
+    for (uint32_t i = 0; i < DIRBENCH_ENTRIES; i++) {
+        uint32_t len = bench_path(path, i);
+        if (elixir_unlink(drive, DIRBENCH_DIR_INO, path + DIRBENCH_NAME, len) != 0) failed++;
+    }
+    uint64_t t7 = ktime_ns();
+
+    bench_path(path, DIRBENCH_ENTRIES / 2);
+    if (elixir_namei(drive, path) != UINT32_MAX) failed++;
+
+    // Give the directory's blocks back
+    if (elixir_unlink(drive, ELIXIR_ROOT_INO, "bench", 5) != 0 ||
+        elixir_read_index(drive, DIRBENCH_DIR_INO, &dir) != 0 ||
+        elixir_file_truncate(drive, &dir, 0) != 0 ||
+        elixir_write_index(drive, DIRBENCH_DIR_INO, &dir) != 0)
+        failed++;
+
+    serial_printf("dirbench drive=%u entries=%u create_ns=%u lookup_cold_ns=%u lookup_warm_ns=%u "
+                  "unlink_ns=%u buckets_per_component_milli=%u disk_reads_per_path_milli=%u "
+                  "grows=%u dcache_hits=%u dcache_misses=%u failed=%u\n",
+                  drive, DIRBENCH_ENTRIES,
+                  ns_per_op(t1 - t0, DIRBENCH_ENTRIES), ns_per_op(t3 - t2, DIRBENCH_LOOKUPS),
+                  ns_per_op(t5 - t4, DIRBENCH_LOOKUPS), ns_per_op(t7 - t6, DIRBENCH_ENTRIES),
+                  buckets_per_component, reads_per_path, d1.grows - start.grows,
+                  c1.hits - c0.hits, c1.misses - c0.misses, failed);
+    return failed ? -1 : 0;
+}
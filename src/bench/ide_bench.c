@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <bench.h>
+#include <ide.h>
+#include <blk.h>
+#include <pmm.h>
+#include <serial.h>
+#include <commands.h>
+
+#define IDEBENCH_ORDER      4                   // 64 KB transfer buffer
+#define IDEBENCH_SECTORS    128                 // Sectors per command
+#define IDEBENCH_TOTAL      (8 * 1024 * 2)      // 8 MB of sectors per pass
+
+// Cycles per sector without 64-bit division
+static uint32_t cycles_per_sector(uint64_t cycles, uint32_t sectors) {
+    while (cycles > 0xFFFFFFFFull) {
+        cycles >>= 1;
+        sectors >>= 1;
+    }
+    return sectors ? (uint32_t)cycles / sectors : 0;
+}
+
+static const struct {
+    const char *name;
+    uint8_t dma;
+    uint8_t irq;
+} modes[] = {
+    { "pio-poll", 0, 0 },
+    { "pio-irq",  0, 1 },
+    { "dma-poll", 1, 0 },
+    { "dma-irq",  1, 1 },
+};
+
+// Wall-clock cost per command, and how much of it the CPU spent halted
+static void report(uint8_t drive, const char *mode, const char *op, uint32_t sectors,
+                   uint64_t cycles, uint64_t slept) {
+    uint64_t idle = slept, total = cycles;
+    while (total > 0x003FFFFFull) {
+        total >>= 1;
+        idle >>= 1;
+    }
+
+    serial_printf("idebench drive=%u mode=%s op=%s sectors=%u kcycles=%u cycles_per_sector=%u "
+                  "cycles_per_cmd=%u busy_kcycles=%u idle_permille=%u\n",
+                  drive, mode, op, sectors, (uint32_t)(cycles >> 10),
+                  cycles_per_sector(cycles, sectors),
+                  cycles_per_sector(cycles, sectors / IDEBENCH_SECTORS),
+                  (uint32_t)((cycles - slept) >> 10),
+                  total ? (uint32_t)idle * 1000u / (uint32_t)total : 0);
+}
+
+#define IDEBENCH_META_ROUNDS    32
+#define IDEBENCH_META_SECTORS   8       // Bitmap-sized second write
+
+// A metadata update as Elixir does it: one superblock sector and a short
+// bitmap run, flushed after every write versus one barrier for both
+static void meta_bench(uint8_t drive, uint8_t *buf) {
+    uint8_t *sb = buf;
+    uint8_t *bitmap = buf + 512;
+
+    if (blk_read(drive, 1, 1 + IDEBENCH_META_SECTORS, buf) != 0) return;
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < IDEBENCH_META_ROUNDS; i++) {
+        ide_write_sectors_counted(drive, 1, 512, sb);
+        ide_flush_cache(drive);
+        ide_write_sectors_counted(drive, 2, IDEBENCH_META_SECTORS * 512, bitmap);
+        ide_flush_cache(drive);
+    }
+    uint64_t each = rdtsc() - start;
+
+    start = rdtsc();
+    for (int i = 0; i < IDEBENCH_META_ROUNDS; i++) {
+        blk_write(drive, 1, 1, sb, 0);
+        blk_write(drive, 2, IDEBENCH_META_SECTORS, bitmap, 0);
+        blk_flush(drive);
+    }
+    uint64_t barrier = rdtsc() - start;
+
+    serial_printf("idebench drive=%u op=meta rounds=%u flush_each_kcycles=%u one_barrier_kcycles=%u fua=%u\n",
+                  drive, IDEBENCH_META_ROUNDS, (uint32_t)(each >> 10), (uint32_t)(barrier >> 10),
+                  ide_devices[drive].Fua);
+}
+
+// Sequential reads from the start of the disk, then each chunk written back
+// with the data it already held so the disk contents do not change. Each
+// pass runs with polled and with interrupt-driven completion.
+void ide_bench(uint8_t drive) {
+    if (drive > 3 || !ide_devices[drive].Reserved) {
+        serial_printf("idebench error=no_drive drive=%u\n", drive);
+        return;
+    }
+
+    uint32_t total = IDEBENCH_TOTAL;
+    if (total > ide_devices[drive].Size) total = ide_devices[drive].Size & ~(IDEBENCH_SECTORS - 1);
+
+    uint8_t *buf = alloc_pages(IDEBENCH_ORDER);
+    if (!buf) {
+        serial_printf("idebench error=no_memory\n");
+        return;
+    }
+
+    uint8_t channel = ide_devices[drive].Channel;
+    struct ide_channel *ch = &channels[channel];
+    uint8_t dma = ide_devices[drive].Dma;
+    uint8_t irq = !ch->nIEN;
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        if (modes[m].dma && !dma) continue;
+        ide_devices[drive].Dma = modes[m].dma;
+        ide_set_irq(channel, modes[m].irq);
+
+        uint64_t slept = ch->sleep_cycles;
+        uint64_t start = rdtsc();
+        for (uint32_t lba = 0; lba < total; lba += IDEBENCH_SECTORS)
+            ide_read_sectors(drive, IDEBENCH_SECTORS, lba, buf);
+        report(drive, modes[m].name, "read", total, rdtsc() - start, ch->sleep_cycles - slept);
+
+        uint64_t cycles = 0;
+        slept = 0;
+        for (uint32_t lba = 0; lba < total; lba += IDEBENCH_SECTORS) {
+            ide_read_sectors(drive, IDEBENCH_SECTORS, lba, buf);
+            uint64_t before = ch->sleep_cycles;
+            uint64_t t = rdtsc();
+            ide_write_sectors_counted(drive, lba, IDEBENCH_SECTORS * 512, buf);
+            cycles += rdtsc() - t;
+            slept += ch->sleep_cycles - before;
+        }
+        report(drive, modes[m].name, "write", total, cycles, slept);
+
+        // A DMA error during the run leaves the drive on PIO
+        if (modes[m].dma && !ide_devices[drive].Dma) dma = 0;
+    }
+
+    ide_devices[drive].Dma = dma;
+    ide_set_irq(channel, irq);
+    meta_bench(drive, buf);
+    serial_printf("idebench irqs=%u timeouts=%u\n", ch->irq_count, ch->irq_timeouts);
+
+    free_pages(buf, IDEBENCH_ORDER);
+}
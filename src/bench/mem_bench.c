@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <bench.h>
+#include <mem.h>
+#include <memops.h>
+#include <pmm.h>
+#include <serial.h>
+#include <commands.h>
+
+#define MEMBENCH_ORDER      8                   // 1 MB buffers
+#define MEMBENCH_MAX_SIZE   (PAGE_SIZE << MEMBENCH_ORDER)
+#define MEMBENCH_BYTES      (2 * 1024 * 1024)   // Bytes moved per data point
+#define MEMBENCH_SECTOR     512
+
+enum { OP_COPY, OP_SET, OP_CMP };
+static const char *op_names[] = { "memcpy", "memset", "memcmp" };
+
+// Bytes per cycle scaled by 1000, without 64-bit division
+static uint32_t per_cycle_milli(uint32_t bytes, uint64_t cycles) {
+    while (cycles > 0xFFFFFFFFull || bytes > 4000000) {
+        cycles >>= 1;
+        bytes >>= 1;
+    }
+    if (!cycles) return 0;
+    return bytes * 1000u / (uint32_t)cycles;
+}
+
+static void run_op(const struct memops_variant *v, int op, uint8_t *dst, uint8_t *src, size_t size) {
+    switch (op) {
+    case OP_COPY: v->copy(dst, src, size); break;
+    case OP_SET:  v->set(dst, 0x5A, size); break;
+    case OP_CMP:  (void)v->cmp(dst, src, size); break;
+    }
+}
+
+void mem_bench(void) {
+    uint8_t *src = alloc_pages(MEMBENCH_ORDER);
+    uint8_t *dst = alloc_pages(MEMBENCH_ORDER);
+    if (!src || !dst) {
+        serial_printf("membench error=no_memory\n");
+        if (src) free_pages(src, MEMBENCH_ORDER);
+        if (dst) free_pages(dst, MEMBENCH_ORDER);
+        return;
+    }
+
+    for (uint32_t i = 0; i < MEMBENCH_MAX_SIZE; i++)
+        src[i] = dst[i] = (uint8_t)i;
+
+    for (int vi = 0; vi < memops_variant_count; vi++) {
+        const struct memops_variant *v = &memops_variants[vi];
+        if (!memops_variant_usable(v)) continue;
+
+        for (int op = OP_COPY; op <= OP_CMP; op++) {
+            for (size_t size = 16; size <= MEMBENCH_MAX_SIZE; size <<= 2) {
+                uint32_t iterations = MEMBENCH_BYTES / size;
+                if (iterations == 0) iterations = 1;
+
+                if (op == OP_CMP) v->copy(dst, src, size);
+                run_op(v, op, dst, src, size);
+
+                uint64_t start = rdtsc();
+                for (uint32_t i = 0; i < iterations; i++)
+                    run_op(v, op, dst, src, size);
+                uint64_t cycles = rdtsc() - start;
+
+                uint32_t milli = per_cycle_milli(iterations * size, cycles);
+                serial_printf("membench op=%s variant=%s size=%u bytes_per_cycle=%u.%u%u%u\n",
+                              op_names[op], v->name, (unsigned)size, milli / 1000,
+                              (milli / 100) % 10, (milli / 10) % 10, milli % 10);
+            }
+        }
+    }
+
+    // The dispatched memcpy, whose aligned sector copies take their own
+    // path. The size is read through a volatile so the call is not inlined.
+    volatile size_t sector = MEMBENCH_SECTOR;
+    uint32_t iterations = MEMBENCH_BYTES / MEMBENCH_SECTOR;
+
+    memcpy(dst, src, sector);
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++)
+        memcpy(dst, src, sector);
+    uint64_t cycles = rdtsc() - start;
+
+    uint32_t milli = per_cycle_milli(iterations * MEMBENCH_SECTOR, cycles);
+    serial_printf("membench op=memcpy variant=dispatch size=%u aligned=16 bytes_per_cycle=%u.%u%u%u\n",
+                  MEMBENCH_SECTOR, milli / 1000, (milli / 100) % 10, (milli / 10) % 10, milli % 10);
+
+    serial_printf("membench active=%s\n", memops_active()->name);
+
+    free_pages(src, MEMBENCH_ORDER);
+    free_pages(dst, MEMBENCH_ORDER);
+}
@@ -0,0 +1,466 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <bcache.h>
+#include <blk.h>
+#include <mem.h>
+#include <pmm.h>
+#include <clock.h>
+#include <vga.h>
+#include <serial.h>
+
+#define BH_WRITEBACK    0x04    // Queued by bcache_write_dirty
+#define BH_INFLIGHT     0x08    // Readahead read queued, req not yet reaped
+#define BH_READAHEAD    0x10    // Loaded by readahead and not used since
+#define BCACHE_ANY      0xFF
+
+static struct buffer_head *hash[BCACHE_HASH_SIZE];
+static struct buffer_head *clock_hand;     // Circular list of every buffer
+static struct bcache_stats stats = { .budget = BCACHE_DEFAULT_BUDGET };
+static uint64_t next_writeback_ns;
+static struct bcache_stream streams[BLK_MAX_DRIVES];
+
+static uint32_t bcache_hash(uint8_t drive, uint32_t block) {
+    return ((block ^ ((uint32_t)drive << 28)) * 2654435761u) >> 24;
+}
+
+static struct buffer_head *bcache_lookup(uint8_t drive, uint32_t block) {
+    struct buffer_head *bh = hash[bcache_hash(drive, block)];
+    while (bh && (bh->drive != drive || bh->block != block))
+        bh = bh->hash_next;
+    return bh;
+}
+
+static void bcache_unhash(struct buffer_head *bh) {
+    struct buffer_head **link = &hash[bcache_hash(bh->drive, bh->block)];
+    while (*link && *link != bh)
+        link = &(*link)->hash_next;
+    if (*link) *link = bh->hash_next;
+    bh->flags &= ~BH_VALID;
+}
+
+// Settle a buffer whose readahead was queued. Without wait, a read still
+// in flight returns 1. A failed read leaves the buffer unhashed and empty.
+static int bcache_reap(struct buffer_head *bh, int wait) {
+    if (bh->req.status == BLK_PENDING) {
+        if (!wait) return 1;
+        blk_wait(&bh->req);
+    }
+
+    bh->flags &= ~BH_INFLIGHT;
+    if (bh->req.status == 0) return 0;
+
+    stats.ra_wasted++;
+    bcache_unhash(bh);
+    bh->flags = 0;
+    return -1;
+}
+
+/* ============================================================================
+ * WRITEBACK
+ * ============================================================================ */
+
+// One command from the first to the last dirty sector; clean sectors in
+// between go along rather than splitting the write
+static void bcache_queue_write(struct buffer_head *bh) {
+    uint32_t first = (uint32_t)__builtin_ctz(bh->dirty_mask);
+    uint32_t last = 31 - (uint32_t)__builtin_clz(bh->dirty_mask);
+
+    bh->req = (struct blk_request){
+        .drive = bh->drive,
+        .op = BLK_WRITE,
+        .lba = bh->block * BCACHE_BLOCK_SECTORS + first,
+        .count = last - first + 1,
+        .buf = bh->data + first * BLK_SECTOR_SIZE,
+    };
+    if (blk_submit(&bh->req) == 0) bh->flags |= BH_WRITEBACK;
+}
+
+// Collect a queued write and settle the buffer's dirty state
+static int bcache_wait_write(struct buffer_head *bh) {
+    if (!(bh->flags & BH_WRITEBACK)) return -1;
+
+    blk_wait(&bh->req);
+    bh->flags &= ~BH_WRITEBACK;
+    if (bh->req.status != 0) return -1;
+
+    bh->flags &= ~BH_DIRTY;
+    bh->dirty_mask = 0;
+    stats.dirty--;
+    stats.writebacks++;
+    return 0;
+}
+
+// Write back dirty buffers on a drive that were dirtied at or before
+// 'before'. All writes are queued first so the request queue can merge
+// neighbouring blocks into one command.
+static int bcache_write_dirty(uint8_t drive, uint64_t before) {
+    struct buffer_head *bh = clock_hand;
+    int ret = 0;
+
+    if (!bh) return 0;
+
+    do {
+        if ((bh->flags & BH_DIRTY) && bh->dirty_ns <= before &&
+            (drive == BCACHE_ANY || bh->drive == drive)) {
+            bcache_queue_write(bh);
+            if (!(bh->flags & BH_WRITEBACK)) ret = -1;
+        }
+        bh = bh->clock_next;
+    } while (bh != clock_hand);
+
+    do {
+        if ((bh->flags & BH_WRITEBACK) && bcache_wait_write(bh) != 0) {
+            printf("bcache: writeback of block %u failed on drive %u\n", bh->block, bh->drive);
+            ret = -1;
+        }
+        bh = bh->clock_next;
+    } while (bh != clock_hand);
+
+    return ret;
+}
+
+int bcache_writeback(uint8_t drive) {
+    return bcache_write_dirty(drive, UINT64_MAX);
+}
+
+// Everything written through the cache so far reaches stable storage
+int bcache_sync(uint8_t drive) {
+    if (bcache_writeback(drive) != 0) return -1;
+    return blk_flush(drive);
+}
+
+// Timed writeback; run from idle loops, where the timer tick wakes the CPU
+void bcache_idle(void) {
+    uint64_t now = ktime_ns();
+
+    if (now < next_writeback_ns) return;
+    next_writeback_ns = now + BCACHE_WRITEBACK_MS * 1000000ull / 4;
+    if (!stats.dirty) return;
+
+    stats.writeback_runs++;
+    bcache_write_dirty(BCACHE_ANY, now - BCACHE_WRITEBACK_MS * 1000000ull);
+}
+
+/* ============================================================================
+ * ALLOCATION AND EVICTION
+ * ============================================================================ */
+
+// CLOCK sweep for an unpinned buffer, written back and unhashed. Two passes
+// are enough: the first clears every reference bit it passes.
+static struct buffer_head *bcache_evict(void) {
+    for (uint32_t i = 0; clock_hand && i < 2 * stats.buffers; i++) {
+        struct buffer_head *bh = clock_hand;
+        clock_hand = bh->clock_next;
+
+        if (bh->pins) continue;
+        if ((bh->flags & BH_INFLIGHT) && bcache_reap(bh, 0) > 0) continue;
+        if (bh->referenced) {
+            bh->referenced = 0;
+            continue;
+        }
+
+        if (bh->flags & BH_DIRTY) {
+            bcache_queue_write(bh);
+            if (bcache_wait_write(bh) != 0) continue;
+        }
+
+        if (bh->flags & BH_READAHEAD) stats.ra_wasted++;
+        if (bh->flags & BH_VALID) bcache_unhash(bh);
+        bh->flags = 0;
+        stats.evictions++;
+        return bh;
+    }
+    return NULL;
+}
+
+static struct buffer_head *bcache_alloc(void) {
+    if ((stats.buffers + 1) * BCACHE_BLOCK_SIZE > stats.budget) {
+        struct buffer_head *bh = bcache_evict();
+        if (bh) return bh;
+        if (stats.buffers) {
+            printf("bcache: no unpinned buffer within the %u byte budget\n", stats.budget);
+            return NULL;
+        }
+    }
+
+    struct buffer_head *bh = kzalloc(sizeof(struct buffer_head));
+    if (!bh) return NULL;
+
+    bh->data = alloc_pages(size_to_order(BCACHE_BLOCK_SIZE));
+    if (!bh->data) {
+        kfree(bh);
+        return NULL;
+    }
+
+    if (clock_hand) {
+        bh->clock_next = clock_hand->clock_next;
+        clock_hand->clock_next = bh;
+    } else {
+        bh->clock_next = bh;
+        clock_hand = bh;
+    }
+    stats.buffers++;
+    return bh;
+}
+
+static void bcache_free(struct buffer_head *bh) {
+    struct buffer_head *prev = bh;
+    while (prev->clock_next != bh)
+        prev = prev->clock_next;
+
+    if (prev == bh) {
+        clock_hand = NULL;
+    } else {
+        prev->clock_next = bh->clock_next;
+        if (clock_hand == bh) clock_hand = bh->clock_next;
+    }
+
+    free_pages(bh->data, size_to_order(BCACHE_BLOCK_SIZE));
+    kfree(bh);
+    stats.buffers--;
+}
+
+void bcache_set_budget(uint32_t bytes) {
+    stats.budget = bytes;
+
+    while (stats.buffers * BCACHE_BLOCK_SIZE > stats.budget) {
+        struct buffer_head *bh = bcache_evict();
+        if (!bh) break;
+        bcache_free(bh);
+    }
+}
+
+/* ============================================================================
+ * BUFFERS
+ * ============================================================================ */
+
+// Find or load a block and take a reference. With fill clear the caller
+// overwrites the whole buffer, so a miss skips the disk read.
+static struct buffer_head *bcache_getblk(uint8_t drive, uint32_t block, int fill) {
+    if (drive >= BLK_MAX_DRIVES) return NULL;
+
+    uint32_t size = blk_size(drive);
+    uint32_t lba = block * BCACHE_BLOCK_SECTORS;
+    if (lba >= size) return NULL;
+
+    struct buffer_head *bh = bcache_lookup(drive, block);
+    if (bh && (bh->flags & BH_INFLIGHT) && bcache_reap(bh, 1) != 0)
+        bh = NULL;
+
+    if (bh) {
+        stats.hits++;
+        if (bh->flags & BH_READAHEAD) {
+            bh->flags &= ~BH_READAHEAD;
+            stats.ra_hits++;
+        }
+    } else {
+        stats.misses++;
+        if (!(bh = bcache_alloc())) return NULL;
+
+        bh->drive = drive;
+        bh->block = block;
+        bh->sectors = size - lba < BCACHE_BLOCK_SECTORS ? size - lba : BCACHE_BLOCK_SECTORS;
+        bh->flags = 0;
+        if (fill && blk_read(drive, lba, bh->sectors, bh->data) != 0)
+            return NULL;
+
+        bh->flags = BH_VALID;
+        bh->hash_next = hash[bcache_hash(drive, block)];
+        hash[bcache_hash(drive, block)] = bh;
+    }
+
+    bh->referenced = 1;
+    if (bh->pins++ == 0) stats.pinned++;
+    return bh;
+}
+
+struct buffer_head *bcache_get(uint8_t drive, uint32_t block) {
+    return bcache_getblk(drive, block, 1);
+}
+
+void bcache_put(struct buffer_head *bh) {
+    if (!bh || !bh->pins) return;
+    if (--bh->pins == 0) stats.pinned--;
+}
+
+static void bcache_dirty_sectors(struct buffer_head *bh, uint32_t off, uint32_t n) {
+    bh->dirty_mask |= (uint8_t)(((1u << n) - 1) << off);
+    if (bh->flags & BH_DIRTY) return;
+
+    bh->flags |= BH_DIRTY;
+    bh->dirty_ns = ktime_ns();
+    stats.dirty++;
+}
+
+void bcache_mark_dirty(struct buffer_head *bh) {
+    bcache_dirty_sectors(bh, 0, bh->sectors);
+}
+
+/* ============================================================================
+ * READAHEAD
+ * ============================================================================ */
+
+// Queue reads for the blocks in [first, end) that are not cached yet. The
+// request queue merges the run into as few commands as it can.
+static void bcache_readahead(uint8_t drive, uint32_t first, uint32_t end) {
+    uint32_t size = blk_size(drive);
+
+    for (uint32_t block = first; block < end && block * BCACHE_BLOCK_SECTORS < size; block++) {
+        if (bcache_lookup(drive, block)) continue;
+
+        struct buffer_head *bh = bcache_alloc();
+        if (!bh) return;
+
+        uint32_t lba = block * BCACHE_BLOCK_SECTORS;
+        bh->drive = drive;
+        bh->block = block;
+        bh->sectors = size - lba < BCACHE_BLOCK_SECTORS ? size - lba : BCACHE_BLOCK_SECTORS;
+        bh->referenced = 0;
+        bh->req = (struct blk_request){
+            .drive = drive,
+            .op = BLK_READ,
+            .lba = lba,
+            .count = bh->sectors,
+            .buf = bh->data,
+        };
+        if (blk_submit(&bh->req) != 0) {
+            bh->flags = 0;
+            return;
+        }
+
+        bh->flags = BH_VALID | BH_INFLIGHT | BH_READAHEAD;
+        bh->hash_next = hash[bcache_hash(drive, block)];
+        hash[bcache_hash(drive, block)] = bh;
+        stats.ra_issued++;
+    }
+}
+
+// Track the reader of a drive and keep a window of blocks queued ahead of it
+static void bcache_stream_read(uint8_t drive, uint32_t block) {
+    struct bcache_stream *s = &streams[drive];
+    uint32_t max = stats.budget / 4 / BLK_SECTOR_SIZE;
+
+    if (max > BCACHE_RA_MAX) max = BCACHE_RA_MAX;
+    if (max < BCACHE_RA_MIN) max = BCACHE_RA_MIN;
+
+    // First read on the drive: no block can follow a zeroed stream
+    if (!s->window) {
+        s->window = BCACHE_RA_MIN;
+        s->next = UINT32_MAX;
+    }
+
+    if (block + 1 == s->next) return;       // Another sector of the same block
+    if (block == s->next) {
+        s->seq++;
+    } else {
+        s->seq = 0;
+        s->ra_end = 0;
+        s->window = BCACHE_RA_MIN;
+    }
+    s->next = block + 1;
+    if (s->seq < 2) return;
+
+    // Issue more once the reader is into the second half of the window,
+    // and grow it if an earlier window is what got it there
+    uint32_t ahead = s->window / BCACHE_BLOCK_SECTORS;
+    if (s->ra_end > block + 1 + ahead / 2) return;
+
+    if (s->ra_end > block) {
+        s->window = s->window * 2 > max ? max : s->window * 2;
+        ahead = s->window / BCACHE_BLOCK_SECTORS;
+    }
+    if (s->ra_end < block + 1) s->ra_end = block + 1;
+
+    bcache_readahead(drive, s->ra_end, block + 1 + ahead);
+    s->ra_end = block + 1 + ahead;
+}
+
+/* ============================================================================
+ * SECTOR ACCESS
+ * ============================================================================ */
+
+int bcache_read(uint8_t drive, uint32_t lba, uint32_t count, void *buf) {
+    uint8_t *data = (uint8_t *)buf;
+
+    while (count) {
+        uint32_t off = lba % BCACHE_BLOCK_SECTORS;
+        uint32_t n = BCACHE_BLOCK_SECTORS - off < count ? BCACHE_BLOCK_SECTORS - off : count;
+
+        struct buffer_head *bh = bcache_get(drive, lba / BCACHE_BLOCK_SECTORS);
+        if (!bh || off + n > bh->sectors) {
+            bcache_put(bh);
+            return -1;
+        }
+        memcpy(data, bh->data + off * BLK_SECTOR_SIZE, n * BLK_SECTOR_SIZE);
+        bcache_put(bh);
+        bcache_stream_read(drive, lba / BCACHE_BLOCK_SECTORS);
+
+        lba += n;
+        count -= n;
+        data += n * BLK_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+int bcache_write(uint8_t drive, uint32_t lba, uint32_t count, const void *buf) {
+    const uint8_t *data = (const uint8_t *)buf;
+
+    while (count) {
+        uint32_t off = lba % BCACHE_BLOCK_SECTORS;
+        uint32_t n = BCACHE_BLOCK_SECTORS - off < count ? BCACHE_BLOCK_SECTORS - off : count;
+
+        struct buffer_head *bh = bcache_getblk(drive, lba / BCACHE_BLOCK_SECTORS,
+                                               n != BCACHE_BLOCK_SECTORS);
+        if (!bh || off + n > bh->sectors) {
+            bcache_put(bh);
+            return -1;
+        }
+        memcpy(bh->data + off * BLK_SECTOR_SIZE, data, n * BLK_SECTOR_SIZE);
+        bcache_dirty_sectors(bh, off, n);
+        bcache_put(bh);
+
+        lba += n;
+        count -= n;
+        data += n * BLK_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+// Keep the blocks covering a sector range resident until bcache_unpin
+int bcache_pin(uint8_t drive, uint32_t lba, uint32_t count) {
+    uint32_t first = lba / BCACHE_BLOCK_SECTORS;
+    uint32_t last = (lba + count - 1) / BCACHE_BLOCK_SECTORS;
+
+    if (!count) return 0;
+
+    for (uint32_t block = first; block <= last; block++) {
+        if (!bcache_get(drive, block)) {
+            if (block > first)
+                bcache_unpin(drive, lba, (block - first) * BCACHE_BLOCK_SECTORS - lba % BCACHE_BLOCK_SECTORS);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void bcache_unpin(uint8_t drive, uint32_t lba, uint32_t count) {
+    if (!count) return;
+
+    uint32_t last = (lba + count - 1) / BCACHE_BLOCK_SECTORS;
+    for (uint32_t block = lba / BCACHE_BLOCK_SECTORS; block <= last; block++)
+        bcache_put(bcache_lookup(drive, block));
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    *out = stats;
+}
+
+void bcache_dump_stats(void) {
+    serial_printf("bcache hits=%u misses=%u evictions=%u writebacks=%u writeback_runs=%u "
+                  "buffers=%u dirty=%u pinned=%u budget=%u\n",
+                  stats.hits, stats.misses, stats.evictions, stats.writebacks,
+                  stats.writeback_runs, stats.buffers, stats.dirty, stats.pinned, stats.budget);
+    serial_printf("bcache ra_issued=%u ra_hits=%u ra_wasted=%u ra_hit_permille=%u\n",
+                  stats.ra_issued, stats.ra_hits, stats.ra_wasted,
+                  stats.ra_issued ? stats.ra_hits * 1000 / stats.ra_issued : 0);
+}
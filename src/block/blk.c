@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <blk.h>
+#include <vga.h>
+#include <serial.h>
+
+static struct block_device *devices[BLK_MAX_DRIVES];
+static struct blk_stats stats[BLK_MAX_DRIVES];
+
+// Plain writes sent since the last cache flush
+static uint8_t cache_dirty[BLK_MAX_DRIVES];
+
+int blk_register(uint8_t drive, struct block_device *dev) {
+    if (drive >= BLK_MAX_DRIVES || devices[drive]) {
+        printf("blk: drive %u is taken or out of range\n", drive);
+        return -1;
+    }
+
+    dev->drive = drive;
+    devices[drive] = dev;
+    return 0;
+}
+
+struct block_device *blk_device(uint8_t drive) {
+    return drive < BLK_MAX_DRIVES ? devices[drive] : NULL;
+}
+
+uint32_t blk_size(uint8_t drive) {
+    struct block_device *dev = blk_device(drive);
+    return dev ? dev->ops->size(dev) : 0;
+}
+
+uint32_t blk_max_sectors(uint8_t drive) {
+    struct block_device *dev = blk_device(drive);
+    return dev ? dev->max_sectors : 0;
+}
+
+static void blk_account(uint8_t drive, uint8_t op, uint32_t count) {
+    if (op == BLK_READ) {
+        stats[drive].reads++;
+        stats[drive].sectors_read += count;
+    } else {
+        stats[drive].writes++;
+        stats[drive].sectors_written += count;
+        cache_dirty[drive] = 1;
+    }
+}
+
+/* ============================================================================
+ * SYNCHRONOUS I/O
+ * ============================================================================ */
+
+int blk_read(uint8_t drive, uint32_t lba, uint32_t count, void *buf) {
+    struct block_device *dev = blk_device(drive);
+    if (!dev) return -1;
+
+    blk_account(drive, BLK_READ, count);
+    if (dev->ops->read(dev, lba, count, buf) != 0) {
+        printf("blk: read of %u sectors at %u failed on drive %u\n", count, lba, drive);
+        return -1;
+    }
+    return 0;
+}
+
+int blk_write(uint8_t drive, uint32_t lba, uint32_t count, const void *buf, uint32_t flags) {
+    struct block_device *dev = blk_device(drive);
+    if (!dev) return -1;
+
+    if (flags & BLK_FUA) {
+        stats[drive].writes++;
+        stats[drive].fua_writes++;
+        stats[drive].sectors_written += count;
+    } else {
+        blk_account(drive, BLK_WRITE, count);
+    }
+
+    if (dev->ops->write(dev, lba, count, buf, flags) != 0) {
+        printf("blk: write of %u sectors at %u failed on drive %u\n", count, lba, drive);
+        return -1;
+    }
+    return 0;
+}
+
+int blk_flush(uint8_t drive) {
+    struct block_device *dev = blk_device(drive);
+    if (!dev) return -1;
+
+    if (!cache_dirty[drive]) {
+        stats[drive].flushes_coalesced++;
+        return 0;
+    }
+
+    if (dev->ops->flush(dev) != 0) {
+        printf("blk: cache flush failed on drive %u\n", drive);
+        return -1;
+    }
+
+    cache_dirty[drive] = 0;
+    stats[drive].flushes++;
+    return 0;
+}
+
+/* ============================================================================
+ * REQUESTS
+ * ============================================================================ */
+
+// Queued backends complete the request later; the rest finish it here
+int blk_submit(struct blk_request *req) {
+    struct block_device *dev = blk_device(req->drive);
+    if (!dev) return -1;
+
+    // A masked channel completes the request inside blkq_submit, and its
+    // callback may free or resubmit it
+    if (dev->channel >= 0) {
+        uint8_t drive = req->drive, op = req->op;
+        uint32_t count = req->count;
+
+        if (blkq_submit(req) != 0) return -1;
+        blk_account(drive, op, count);
+        return 0;
+    }
+
+    int ret = req->op == BLK_READ ? dev->ops->read(dev, req->lba, req->count, req->buf)
+                                  : dev->ops->write(dev, req->lba, req->count, req->buf, 0);
+    blk_account(req->drive, req->op, req->count);
+    req->status = ret ? -1 : 0;
+    if (req->done) req->done(req);
+    return 0;
+}
+
+void blk_wait(struct blk_request *req) {
+    if (req->status == BLK_PENDING) blkq_wait(req);
+}
+
+// Wait until nothing is queued or in flight for the drive
+void blk_drain(uint8_t drive) {
+    struct block_device *dev = blk_device(drive);
+    if (dev && dev->channel >= 0) blkq_drain((uint8_t)dev->channel);
+}
+
+void blk_get_stats(uint8_t drive, struct blk_stats *out) {
+    if (drive >= BLK_MAX_DRIVES) return;
+    *out = stats[drive];
+}
+
+// Queue behaviour per channel, as key=value lines on the serial port.
+// Latencies are ns >> 10, within 3% of microseconds without a 64-bit divide.
+void blk_dump_stats(void) {
+    for (uint8_t channel = 0; channel < BLK_CHANNELS; channel++) {
+        struct blk_queue_stats qs;
+        blk_queue_get_stats(channel, &qs);
+        if (!qs.submitted) continue;
+
+        serial_printf("blkq channel=%u submitted=%u commands=%u merged=%u errors=%u "
+                      "max_depth=%u depth_sum=%u latency_us_total=%u max_latency_us=%u\n",
+                      channel, qs.submitted, qs.commands, qs.merged, qs.errors,
+                      qs.max_depth, (uint32_t)qs.depth_sum,
+                      (uint32_t)(qs.latency_ns >> 10), (uint32_t)(qs.max_latency_ns >> 10));
+    }
+}
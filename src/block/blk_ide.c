@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <blk.h>
+#include <ide.h>
+#include <vga.h>
+
+static struct block_device ide_blk[4];
+static const char *const ide_blk_names[4] = { "ide0", "ide1", "ide2", "ide3" };
+
+// Queue one request per chunk the drive can take and wait for each
+static int ide_blk_rw(struct block_device *dev, uint8_t op, uint32_t lba, uint32_t count, void *buf) {
+    uint32_t max = ide_max_sectors(dev->drive);
+    uint8_t *data = (uint8_t *)buf;
+
+    while (count) {
+        struct blk_request req = {
+            .drive = dev->drive,
+            .op = op,
+            .lba = lba,
+            .count = count < max ? count : max,
+            .buf = data,
+        };
+
+        if (blkq_submit(&req) != 0) return -1;
+        blkq_wait(&req);
+        if (req.status != 0) return -1;
+
+        lba += req.count;
+        count -= req.count;
+        data += req.count * BLK_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+static int ide_blk_read(struct block_device *dev, uint32_t lba, uint32_t count, void *buf) {
+    return ide_blk_rw(dev, BLK_READ, lba, count, buf);
+}
+
+static int ide_blk_write(struct block_device *dev, uint32_t lba, uint32_t count,
+                         const void *buf, uint32_t flags) {
+    if (!(flags & BLK_FUA))
+        return ide_blk_rw(dev, BLK_WRITE, lba, count, (void *)buf);
+
+    // FUA writes are ordered after everything already queued
+    blkq_drain((uint8_t)dev->channel);
+    return ide_write_sectors_fua(dev->drive, lba, (size_t)count * BLK_SECTOR_SIZE, buf) ? -1 : 0;
+}
+
+static int ide_blk_flush(struct block_device *dev) {
+    blkq_drain((uint8_t)dev->channel);
+    return ide_flush_cache(dev->drive) ? -1 : 0;
+}
+
+static uint32_t ide_blk_size(struct block_device *dev) {
+    return ide_devices[dev->drive].Size;
+}
+
+static const struct block_device_ops ide_blk_ops = {
+    .read = ide_blk_read,
+    .write = ide_blk_write,
+    .flush = ide_blk_flush,
+    .size = ide_blk_size,
+};
+
+// Register every detected IDE drive; run after ide_initialize()
+void blk_ide_init(void) {
+    for (uint8_t drive = 0; drive < 4; drive++) {
+        if (!ide_devices[drive].Reserved) continue;
+
+        ide_blk[drive] = (struct block_device){
+            .name = ide_blk_names[drive],
+            .ops = &ide_blk_ops,
+            .channel = (int8_t)ide_devices[drive].Channel,
+            .max_sectors = ide_max_sectors(drive),
+        };
+        blk_register(drive, &ide_blk[drive]);
+    }
+}
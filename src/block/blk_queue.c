@@ -0,0 +1,402 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <blk.h>
+#include <ide.h>
+#include <clock.h>
+#include <commands.h>
+#include <cpu.h>
+#include <vga.h>
+
+#define BLKQ_MAX_KICKS  3       // Timeouts with the drive busy before its command is failed
+
+struct blk_queue {
+    struct blk_request *pending;    // Sorted by LBA
+    struct blk_request *active;     // Requests carried by the command in flight
+    uint32_t head;                  // LBA just past the last command
+    uint8_t  drive;
+    uint8_t  op;
+    uint8_t  dma;
+
+    // PIO progress through the active chain
+    struct blk_request *cur;
+    uint32_t cur_off;
+    uint32_t left;
+
+    struct blk_queue_stats stats;
+};
+
+static struct blk_queue queues[BLK_CHANNELS];
+
+static void blk_queue_irq(uint8_t channel);
+
+/* ============================================================================
+ * COMPLETION
+ * ============================================================================ */
+
+static void blk_complete(struct blk_queue *q, struct blk_request *req, int status) {
+    uint64_t latency = ktime_ns() - req->submit_ns;
+
+    q->stats.completed++;
+    q->stats.depth--;
+    q->stats.latency_ns += latency;
+    if (latency > q->stats.max_latency_ns) q->stats.max_latency_ns = latency;
+    if (status) q->stats.errors++;
+
+    // The callback may free or resubmit the request
+    req->status = status;
+    if (req->done) req->done(req);
+}
+
+static void blk_dispatch(uint8_t channel);
+
+// The command in flight is over: complete everything it carried and start
+// the next one
+static void blk_finish(uint8_t channel, int status) {
+    struct blk_queue *q = &queues[channel];
+    struct blk_request *req = q->active;
+
+    q->active = NULL;
+    channels[channel].irq_hook = NULL;
+
+    while (req) {
+        struct blk_request *next = req->next;
+        blk_complete(q, req, status);
+        req = next;
+    }
+
+    blk_dispatch(channel);
+}
+
+/* ============================================================================
+ * DISPATCH
+ * ============================================================================ */
+
+// C-LOOK: the lowest LBA at or past the head, wrapping to the lowest overall
+static struct blk_request **blk_pick(struct blk_queue *q) {
+    struct blk_request **link = &q->pending;
+
+    while (*link && (*link)->lba < q->head)
+        link = &(*link)->next;
+    return *link ? link : &q->pending;
+}
+
+// Unlink the chosen request plus every queued request that continues it,
+// leaving them chained on q->active
+static uint32_t blk_gather(struct blk_queue *q, struct blk_request **link,
+                           struct ide_sg *sg, int *nsg) {
+    struct blk_request *first = *link;
+    struct blk_request *tail = first;
+    uint32_t max = ide_max_sectors(first->drive);
+    uint32_t total = first->count;
+
+    *link = first->next;
+    sg[0].buf = first->buf;
+    sg[0].sectors = first->count;
+    *nsg = 1;
+
+    // Sorted order puts continuations right behind; equal LBAs are skipped
+    while (*link && *nsg < BLKQ_MAX_SG) {
+        struct blk_request *next = *link;
+
+        if (next->lba < first->lba + total) {
+            link = &next->next;
+            continue;
+        }
+        if (next->lba != first->lba + total || next->drive != first->drive ||
+            next->op != first->op || total + next->count > max)
+            break;
+
+        *link = next->next;
+        tail->next = next;
+        tail = next;
+        sg[*nsg].buf = next->buf;
+        sg[*nsg].sectors = next->count;
+        (*nsg)++;
+        total += next->count;
+        q->stats.merged++;
+    }
+
+    tail->next = NULL;
+    q->active = first;
+    q->head = first->lba + total;
+    return total;
+}
+
+static void blk_pio_move(struct blk_queue *q, uint8_t channel, uint32_t sectors) {
+    uint16_t bus = channels[channel].base;
+
+    while (sectors--) {
+        uint8_t *data = (uint8_t *)q->cur->buf + q->cur_off * BLK_SECTOR_SIZE;
+
+        if (q->op == BLK_READ) insw(bus, data, BLK_SECTOR_SIZE / 2);
+        else outsw(bus, data, BLK_SECTOR_SIZE / 2);
+
+        if (++q->cur_off == q->cur->count) {
+            q->cur = q->cur->next;
+            q->cur_off = 0;
+        }
+        q->left--;
+    }
+}
+
+// Issue the active chain as one PIO command; the IRQ hook moves the rest
+static int blk_start_pio(uint8_t channel, uint32_t lba, uint32_t total) {
+    struct blk_queue *q = &queues[channel];
+    uint8_t op = q->op == BLK_READ ? IDE_OP_READ : IDE_OP_WRITE;
+
+    q->dma = 0;
+    q->cur = q->active;
+    q->cur_off = 0;
+    q->left = total;
+
+    channels[channel].irq_hook = blk_queue_irq;
+    if (ide_pio_command(q->drive, op, lba, total)) return -1;
+
+    // The first block of a write goes out without an interrupt
+    if (q->op == BLK_WRITE) {
+        if (ide_polling(channel, 0)) return -1;
+        uint32_t block = ide_pio_block(q->drive);
+        blk_pio_move(q, channel, q->left < block ? q->left : block);
+    }
+    return 0;
+}
+
+// Run the active chain to completion without interrupts
+static void blk_run_sync(uint8_t channel) {
+    struct blk_queue *q = &queues[channel];
+    struct blk_request *req = q->active;
+
+    q->active = NULL;
+    while (req) {
+        struct blk_request *next = req->next;
+        int ret = req->op == BLK_READ
+                ? ide_read_sectors(req->drive, req->count, req->lba, req->buf)
+                : ide_write_sectors_counted(req->drive, req->lba,
+                                            (size_t)req->count * BLK_SECTOR_SIZE, req->buf);
+        blk_complete(q, req, ret ? -1 : 0);
+        req = next;
+    }
+}
+
+// Start the next command if the channel is idle. Called with interrupts off.
+static void blk_dispatch(uint8_t channel) {
+    struct blk_queue *q = &queues[channel];
+    struct ide_sg sg[BLKQ_MAX_SG];
+    int nsg;
+
+    while (!q->active && q->pending) {
+        struct blk_request **link = blk_pick(q);
+        uint32_t lba = (*link)->lba;
+        uint32_t total = blk_gather(q, link, sg, &nsg);
+
+        q->drive = q->active->drive;
+        q->op = q->active->op;
+        q->stats.commands++;
+
+        // Masked drive interrupt: nothing would ever finish the command
+        if (channels[channel].nIEN) {
+            blk_run_sync(channel);
+            continue;
+        }
+
+        uint8_t op = q->op == BLK_READ ? IDE_OP_READ : IDE_OP_WRITE;
+        if (ide_dma_usable_sg(q->drive, sg, nsg)) {
+            q->dma = 1;
+            channels[channel].irq_hook = blk_queue_irq;
+            if (ide_dma_start(q->drive, op, lba, sg, nsg) == 0) return;
+        }
+        if (blk_start_pio(channel, lba, total) == 0) return;
+
+        channels[channel].irq_hook = NULL;
+        blk_finish(channel, -1);
+        return;
+    }
+}
+
+// Interrupt for the command in flight: move the next PIO block or wrap up
+static void blk_queue_irq(uint8_t channel) {
+    struct blk_queue *q = &queues[channel];
+    uint8_t status = channels[channel].irq_status;
+
+    if (!q->active) return;
+    channels[channel].irq_fired = 0;
+
+    if (q->dma) {
+        uint8_t op = q->op == BLK_READ ? IDE_OP_READ : IDE_OP_WRITE;
+
+        // Not done yet: a later interrupt or the blkq_idle timeout comes back
+        if (ide_dma_busy(q->drive)) return;
+
+        int err = ide_dma_finish(q->drive, op);
+
+        // The drive has dropped to PIO; give the same chain a second try
+        // unless it is wedged
+        if (err && !ide_devices[q->drive].Dma && !(ide_read(channel, ATA_REG_STATUS) & ATA_SR_BSY)) {
+            uint32_t total = 0;
+            for (struct blk_request *req = q->active; req; req = req->next)
+                total += req->count;
+            if (blk_start_pio(channel, q->active->lba, total) == 0) return;
+        }
+        blk_finish(channel, err ? -1 : 0);
+        return;
+    }
+
+    // A late interrupt for a block that polling already moved
+    if (status & ATA_SR_BSY) return;
+
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        blk_finish(channel, -1);
+        return;
+    }
+
+    uint32_t block = ide_pio_block(q->drive);
+    if (q->op == BLK_READ) {
+        if (!(status & ATA_SR_DRQ)) {
+            blk_finish(channel, -1);
+            return;
+        }
+        blk_pio_move(q, channel, q->left < block ? q->left : block);
+        if (q->left == 0) blk_finish(channel, 0);
+        return;
+    }
+
+    // Writes: the last interrupt reports the end of the command
+    if (q->left == 0) blk_finish(channel, 0);
+    else blk_pio_move(q, channel, q->left < block ? q->left : block);
+}
+
+/* ============================================================================
+ * SUBMISSION
+ * ============================================================================ */
+
+struct blkq_waiter {
+    uint64_t deadline;
+    uint32_t kicks;
+};
+
+static void blkq_idle(uint8_t channel, unsigned long flags, struct blkq_waiter *w);
+
+// A queued request that the new one must not overtake: they overlap and
+// at least one of them writes
+static int blk_conflict(const struct blk_queue *q, const struct blk_request *req) {
+    for (const struct blk_request *p = q->pending; p; p = p->next) {
+        if (p->drive == req->drive && (p->op == BLK_WRITE || req->op == BLK_WRITE) &&
+            p->lba < req->lba + req->count && req->lba < p->lba + p->count)
+            return 1;
+    }
+    return 0;
+}
+
+int blkq_submit(struct blk_request *req) {
+    if (req->drive >= 4 || !ide_devices[req->drive].Reserved) return -1;
+    if (req->count == 0 || req->count > ide_max_sectors(req->drive)) {
+        printf("blk: request of %u sectors on drive %u is too large\n", req->count, req->drive);
+        return -1;
+    }
+
+    uint8_t channel = ide_devices[req->drive].Channel;
+    struct blk_queue *q = &queues[channel];
+
+    req->status = BLK_PENDING;
+    req->submit_ns = ktime_ns();
+
+    unsigned long flags = save_and_cli();
+
+    // LBA order could send it out before an overlapping request queued
+    // earlier, so those are let through first
+    struct blkq_waiter w = { ktime_ns() + IDE_IRQ_TIMEOUT_MS * 1000000ull, 0 };
+    while (blk_conflict(q, req))
+        blkq_idle(channel, flags, &w);
+
+    struct blk_request **link = &q->pending;
+    while (*link && (*link)->lba <= req->lba)
+        link = &(*link)->next;
+    req->next = *link;
+    *link = req;
+
+    q->stats.submitted++;
+    q->stats.depth++;
+    q->stats.depth_sum += q->stats.depth;
+    if (q->stats.depth > q->stats.max_depth) q->stats.max_depth = q->stats.depth;
+
+    blk_dispatch(channel);
+    restore_flags(flags);
+    return 0;
+}
+
+// Move the command in flight along by polling, as its interrupt would.
+// Returns -1 while the drive is still busy with it.
+static int blk_kick(uint8_t channel) {
+    struct blk_queue *q = &queues[channel];
+
+    if (!q->active) return 0;
+
+    ide_delay(channel);
+    uint8_t status = ide_read(channel, ATA_REG_STATUS);
+    if ((status & ATA_SR_BSY) || (q->dma && ((status & ATA_SR_DRQ) || ide_dma_busy(q->drive))))
+        return -1;
+
+    channels[channel].irq_status = status;
+    blk_queue_irq(channel);
+    return 0;
+}
+
+// One turn of a wait loop, entered with interrupts off. Halts until the
+// next interrupt when the caller allows it and polls the drive otherwise,
+// like ide_wait_irq. A timeout polls too, in case the interrupt was lost;
+// a drive still busy after BLKQ_MAX_KICKS of them fails its command.
+static void blkq_idle(uint8_t channel, unsigned long flags, struct blkq_waiter *w) {
+    struct blk_queue *q = &queues[channel];
+    int sleep = (flags & EFLAGS_IF) && !irq_nesting && !channels[channel].nIEN;
+
+    if (ktime_ns() < w->deadline) {
+        if (sleep) asm volatile ("sti; hlt; cli" ::: "memory");
+        else if (blk_kick(channel) == 0) w->deadline = ktime_ns() + IDE_IRQ_TIMEOUT_MS * 1000000ull;
+        return;
+    }
+
+    w->deadline = ktime_ns() + IDE_IRQ_TIMEOUT_MS * 1000000ull;
+    if (blk_kick(channel) == 0) {
+        if (sleep) channels[channel].irq_timeouts++;
+        w->kicks = 0;
+        return;
+    }
+    if (++w->kicks < BLKQ_MAX_KICKS) return;
+
+    printf("blk: drive %u stays busy, failing its command\n", q->drive);
+    w->kicks = 0;
+    if (q->dma) ide_dma_finish(q->drive, q->op == BLK_READ ? IDE_OP_READ : IDE_OP_WRITE);
+    blk_finish(channel, -1);
+}
+
+// Wait for the request to complete, sleeping when interrupts allow it
+void blkq_wait(struct blk_request *req) {
+    uint8_t channel = ide_devices[req->drive].Channel;
+    unsigned long flags = save_and_cli();
+    struct blkq_waiter w = { ktime_ns() + IDE_IRQ_TIMEOUT_MS * 1000000ull, 0 };
+
+    while (req->status == BLK_PENDING)
+        blkq_idle(channel, flags, &w);
+
+    restore_flags(flags);
+}
+
+// Wait until nothing is queued or in flight on the channel
+void blkq_drain(uint8_t channel) {
+    struct blk_queue *q = &queues[channel];
+    unsigned long flags = save_and_cli();
+    struct blkq_waiter w = { ktime_ns() + IDE_IRQ_TIMEOUT_MS * 1000000ull, 0 };
+
+    while (q->active || q->pending)
+        blkq_idle(channel, flags, &w);
+
+    restore_flags(flags);
+}
+
+void blk_queue_get_stats(uint8_t channel, struct blk_queue_stats *out) {
+    if (channel >= BLK_CHANNELS) return;
+
+    unsigned long flags = save_and_cli();
+    *out = queues[channel].stats;
+    restore_flags(flags);
+}
@@ -0,0 +1,109 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <blk.h>
+#include <mem.h>
+#include <pmm.h>
+#include <vga.h>
+
+// Storage comes in the largest buddy blocks, so a disk is not limited to
+// one contiguous allocation
+#define RAMDISK_CHUNK_SECTORS   ((PAGE_SIZE << MAX_ORDER) / BLK_SECTOR_SIZE)
+
+struct ramdisk {
+    struct block_device dev;
+    uint32_t sectors;
+    uint32_t nchunks;
+    uint8_t **chunks;
+};
+
+// Copy between the disk and buf, one chunk at a time
+static int ramdisk_copy(struct block_device *dev, uint32_t lba, uint32_t count, void *buf, int write) {
+    struct ramdisk *rd = dev->private;
+    uint8_t *data = (uint8_t *)buf;
+
+    if (lba > rd->sectors || count > rd->sectors - lba) return -1;
+
+    while (count) {
+        uint32_t off = lba % RAMDISK_CHUNK_SECTORS;
+        uint32_t n = RAMDISK_CHUNK_SECTORS - off < count ? RAMDISK_CHUNK_SECTORS - off : count;
+        uint8_t *disk = rd->chunks[lba / RAMDISK_CHUNK_SECTORS] + off * BLK_SECTOR_SIZE;
+
+        if (write) memcpy(disk, data, n * BLK_SECTOR_SIZE);
+        else memcpy(data, disk, n * BLK_SECTOR_SIZE);
+
+        lba += n;
+        count -= n;
+        data += n * BLK_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+static int ramdisk_read(struct block_device *dev, uint32_t lba, uint32_t count, void *buf) {
+    return ramdisk_copy(dev, lba, count, buf, 0);
+}
+
+static int ramdisk_write(struct block_device *dev, uint32_t lba, uint32_t count,
+                         const void *buf, uint32_t flags) {
+    (void)flags;
+    return ramdisk_copy(dev, lba, count, (void *)buf, 1);
+}
+
+// Memory has no volatile cache to flush
+static int ramdisk_flush(struct block_device *dev) {
+    (void)dev;
+    return 0;
+}
+
+static uint32_t ramdisk_size(struct block_device *dev) {
+    return ((struct ramdisk *)dev->private)->sectors;
+}
+
+static const struct block_device_ops ramdisk_ops = {
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    .flush = ramdisk_flush,
+    .size = ramdisk_size,
+};
+
+static void ramdisk_free(struct ramdisk *rd) {
+    for (uint32_t i = 0; i < rd->nchunks; i++)
+        if (rd->chunks[i]) free_pages(rd->chunks[i], MAX_ORDER);
+    kfree(rd->chunks);
+    kfree(rd);
+}
+
+// Zero-filled RAM disk of 'sectors' sectors, registered as 'drive'
+int ramdisk_create(uint8_t drive, uint32_t sectors) {
+    struct ramdisk *rd = kzalloc(sizeof(struct ramdisk));
+    if (!rd) return -1;
+
+    rd->sectors = sectors;
+    rd->nchunks = (sectors + RAMDISK_CHUNK_SECTORS - 1) / RAMDISK_CHUNK_SECTORS;
+    rd->chunks = kzalloc(rd->nchunks * sizeof(uint8_t *));
+    if (!rd->chunks) {
+        kfree(rd);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < rd->nchunks; i++) {
+        if (!(rd->chunks[i] = alloc_zeroed_pages(MAX_ORDER))) {
+            printf("ramdisk: no memory for %u sectors\n", sectors);
+            ramdisk_free(rd);
+            return -1;
+        }
+    }
+
+    rd->dev = (struct block_device){
+        .name = "ram",
+        .ops = &ramdisk_ops,
+        .private = rd,
+        .channel = -1,
+        .max_sectors = sectors,
+    };
+
+    if (blk_register(drive, &rd->dev) != 0) {
+        ramdisk_free(rd);
+        return -1;
+    }
+    return 0;
+}
@@ -1,8 +1,11 @@
 ORG 0x7C00
 BITS 16
 
-KERNEL_LOAD_SEG equ 0x0050
+KERNEL_LOAD_SEG equ 0x1000               ; Stage above the boot sector and E820 map
+KERNEL_LOAD_END_SEG equ 0x8000           ; Stop before the stack at 0x90000
 KERNEL_FINAL_OFFSET equ 0x00100000
+E820_MAP_SEG equ 0x0800                  ; Physical 0x8000, read by pmm_init
+E820_MAX_ENTRIES equ 128
 
 start: 
     cli
@@ -59,6 +62,8 @@ start:
     jnc .no_wrap
     mov ax, es
     add ax, 0x1000
+    cmp ax, KERNEL_LOAD_END_SEG
+    jae .load_complete
     mov es, ax
     xor bx, bx
 .no_wrap:
@@ -80,6 +85,10 @@ start:
     mov si, msg_loaded
     call print_string
 
+    push edi
+    call detect_memory
+    pop edi
+
     cli
     lgdt [gdt_descriptor]
     mov eax, cr0
@@ -92,6 +101,33 @@ disk_error:
     call print_string
     jmp $
 
+; Collect the BIOS E820 map: a dword entry count followed by 24-byte entries
+detect_memory:
+    mov ax, E820_MAP_SEG
+    mov es, ax
+    mov di, 4
+    xor ebx, ebx
+    xor bp, bp
+.next:
+    mov eax, 0xE820
+    mov ecx, 24
+    mov edx, 0x534D4150                 ; 'SMAP'
+    mov dword [es:di + 20], 1           ; Valid ACPI 3.x attributes by default
+    int 0x15
+    jc .done
+    cmp eax, 0x534D4150
+    jne .done
+    inc bp
+    add di, 24
+    cmp bp, E820_MAX_ENTRIES
+    jae .done
+    test ebx, ebx
+    jnz .next
+.done:
+    mov [es:0], bp
+    mov word [es:2], 0
+    ret
+
 print_string:
     pusha
 .loop:
@@ -123,9 +159,10 @@ protected_mode_start:
     mov ss, ax
     mov esp, 0x90000
 
-    mov esi, 0x500
+    mov ecx, edi                        ; Sectors loaded
+    shl ecx, 7                          ; 128 dwords per sector
+    mov esi, KERNEL_LOAD_SEG << 4
     mov edi, KERNEL_FINAL_OFFSET
-    mov ecx, 30720                      ; Copy ~120KB (plenty for kernel)
     rep movsd
 
     call KERNEL_FINAL_OFFSET
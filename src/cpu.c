@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <cpu.h>
+#include <commands.h>
+#include <vga.h>
+
+struct cpu_info cpu;
+
+void cpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    *(uint32_t *)&cpu.vendor[0] = ebx;
+    *(uint32_t *)&cpu.vendor[4] = edx;
+    *(uint32_t *)&cpu.vendor[8] = ecx;
+    cpu.vendor[12] = '\0';
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    cpu.features_edx = edx;
+    cpu.features_ecx = ecx;
+    cpu.sse_enabled = 0;
+
+    // x87 on, native error reporting, no emulation or lazy switching
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+    asm volatile ("fninit");
+
+    if (cpu_has(CPUID_EDX_FXSR) && cpu_has(CPUID_EDX_SSE) && cpu_has(CPUID_EDX_SSE2)) {
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+        cpu.sse_enabled = 1;
+    }
+
+    printf("CPU: %s, features edx=0x%x ecx=0x%x, SSE2 %s\n", cpu.vendor,
+           cpu.features_edx, cpu.features_ecx, cpu.sse_enabled ? "on" : "off");
+}
@@ -64,18 +64,29 @@ void ide_initialize(void) {
     channels[ATA_PRIMARY].base  = 0x1F0;
     channels[ATA_PRIMARY].ctrl  = 0x3F6;
     channels[ATA_PRIMARY].bmide = 0;
-    channels[ATA_PRIMARY].nIEN  = 0;
+    channels[ATA_PRIMARY].nIEN  = ATA_CTRL_NIEN;
 
     channels[ATA_SECONDARY].base  = 0x170;
     channels[ATA_SECONDARY].ctrl  = 0x376;
     channels[ATA_SECONDARY].bmide = 0;
-    channels[ATA_SECONDARY].nIEN  = 0;
+    channels[ATA_SECONDARY].nIEN  = ATA_CTRL_NIEN;
 
-    ide_write(ATA_PRIMARY, ATA_REG_CONTROL, 2);
-    ide_write(ATA_SECONDARY, ATA_REG_CONTROL, 2);
+    channels[ATA_PRIMARY].prdt = NULL;
+    channels[ATA_SECONDARY].prdt = NULL;
+    channels[ATA_PRIMARY].irq_hook = NULL;
+    channels[ATA_SECONDARY].irq_hook = NULL;
+
+    // Probe with the drive interrupts masked, then switch to IRQ completion
+    ide_write(ATA_PRIMARY, ATA_REG_CONTROL, ATA_CTRL_NIEN);
+    ide_write(ATA_SECONDARY, ATA_REG_CONTROL, ATA_CTRL_NIEN);
+
+    ide_dma_init();
 
     for (int i = 0; i < 4; i++) {
         ide_devices[i].Reserved = 0;
+        ide_devices[i].Dma = 0;
+        ide_devices[i].Lba48 = 0;
+        ide_devices[i].Fua = 0;
         
         int channel = i / 2;
         int drive = i % 2;
@@ -100,10 +111,19 @@ void ide_initialize(void) {
         ide_identify(channel, drive);
         
         if (ide_devices[i].Reserved) {
-            printf("Found IDE drive %d: %s, Size: %u sectors\n",
-                        i, ide_devices[i].Model, ide_devices[i].Size);
+            ide_devices[i].Dma = channels[channel].bmide &&
+                                 (ide_devices[i].Capabilities & ATA_CAP_DMA);
+            ide_configure(i);
+            printf("Found IDE drive %d: %s, Size: %u sectors, %s mode 0x%x, multiple %u\n",
+                        i, ide_devices[i].Model, ide_devices[i].Size,
+                        ide_devices[i].Dma ? "DMA" : "PIO",
+                        ide_devices[i].Dma ? ide_devices[i].DmaMode : ide_devices[i].PioMode,
+                        ide_devices[i].Multiple);
         }
     }
+
+    ide_set_irq(ATA_PRIMARY, 1);
+    ide_set_irq(ATA_SECONDARY, 1);
 }
 /* ============================================================================
  * HELPER FUNCTIONS
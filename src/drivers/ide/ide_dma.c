@@ -0,0 +1,207 @@
+#include <ide.h>
+#include <pci.h>
+#include <pmm.h>
+#include <commands.h>
+#include <vga.h>
+
+/* ============================================================================
+ * BUS MASTER REGISTERS
+ * ============================================================================ */
+
+static inline uint8_t bm_read(uint8_t channel, uint8_t reg) {
+    return inb(channels[channel].bmide + reg);
+}
+
+static inline void bm_write(uint8_t channel, uint8_t reg, uint8_t data) {
+    outb(channels[channel].bmide + reg, data);
+}
+
+/* ============================================================================
+ * INITIALIZE
+ * ============================================================================ */
+
+// Locate the PCI IDE function and claim its bus master block (BAR4)
+void ide_dma_init(void) {
+    struct pci_device dev;
+    struct ide_prd *prdt[2];
+
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &dev) != 0) {
+        printf("IDE: no PCI IDE controller, using PIO\n");
+        return;
+    }
+
+    if (ide_piix_init(&dev) != 0)
+        printf("IDE: controller %x:%x timings unknown, keeping firmware modes\n", dev.vendor, dev.device);
+
+    uint32_t bar4 = pci_read32(&dev, PCI_BAR4);
+    if (!(dev.prog_if & 0x80) || !(bar4 & PCI_BAR_IO) || !(bar4 & 0xFFFC)) {
+        printf("IDE: controller %x:%x has no bus master, using PIO\n", dev.vendor, dev.device);
+        return;
+    }
+
+    prdt[0] = alloc_pages(0);
+    prdt[1] = alloc_pages(0);
+    if (!prdt[0] || !prdt[1]) {
+        printf("IDE: no memory for PRD tables, using PIO\n");
+        if (prdt[0]) free_pages(prdt[0], 0);
+        if (prdt[1]) free_pages(prdt[1], 0);
+        return;
+    }
+
+    pci_write16(&dev, PCI_COMMAND,
+                pci_read16(&dev, PCI_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    uint16_t base = bar4 & 0xFFFC;
+    for (int c = 0; c < 2; c++) {
+        channels[c].bmide = base + c * 8;
+        channels[c].prdt = prdt[c];
+        bm_write(c, ATA_BM_COMMAND, 0);
+        bm_write(c, ATA_BM_STATUS, ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    }
+
+    printf("IDE: bus master DMA at 0x%x (%x:%x)\n", base, dev.vendor, dev.device);
+}
+
+/* ============================================================================
+ * TRANSFER
+ * ============================================================================ */
+
+// The controller needs even, 32-bit physical buffers that fit one PRD table
+int ide_dma_usable_sg(uint8_t drive, const struct ide_sg *sg, int nsg) {
+    if (drive > 3 || !ide_devices[drive].Reserved || !ide_devices[drive].Dma)
+        return 0;
+
+    uint32_t entries = 0;
+    for (int i = 0; i < nsg; i++) {
+        uint32_t addr = (uint32_t)sg[i].buf;
+        uint32_t bytes = sg[i].sectors * 512;
+
+        if ((addr & 1) || bytes == 0 || addr + bytes < addr)
+            return 0;
+        entries += (bytes + IDE_PRD_BOUNDARY - 1) / IDE_PRD_BOUNDARY + 1;
+    }
+
+    return entries <= IDE_PRD_MAX;
+}
+
+int ide_dma_usable(uint8_t drive, const void *buf, uint32_t bytes) {
+    struct ide_sg sg = { (void *)buf, bytes / 512 };
+    return ide_dma_usable_sg(drive, &sg, 1);
+}
+
+// Append a buffer to the PRD table, splitting regions at 64 KB boundaries
+static uint32_t ide_dma_add_prd(struct ide_prd *prd, uint32_t n, uint32_t addr, uint32_t bytes) {
+    while (bytes) {
+        uint32_t chunk = IDE_PRD_BOUNDARY - (addr & (IDE_PRD_BOUNDARY - 1));
+        if (chunk > bytes) chunk = bytes;
+
+        prd[n].addr = addr;
+        prd[n].count = (uint16_t)chunk;     // 64 KB wraps to 0 as required
+        prd[n].flags = 0;
+
+        addr += chunk;
+        bytes -= chunk;
+        n++;
+    }
+
+    return n;
+}
+
+// Program the PRD table and start READ/WRITE DMA (EXT for LBA48) over a
+// scatter-gather list. Returns without waiting; completion is signalled
+// by the channel IRQ and collected with ide_dma_finish().
+int ide_dma_start(uint8_t drive, uint8_t op, uint32_t lba, const struct ide_sg *sg, int nsg) {
+    uint8_t channel = ide_devices[drive].Channel;
+    uint8_t dir = op == IDE_OP_READ ? ATA_BM_CMD_READ : 0;
+    struct ide_prd *prd = channels[channel].prdt;
+    uint32_t numsects = 0, n = 0;
+
+    for (int i = 0; i < nsg; i++) {
+        n = ide_dma_add_prd(prd, n, (uint32_t)sg[i].buf, sg[i].sectors * 512);
+        numsects += sg[i].sectors;
+    }
+    if (n == 0 || numsects > IDE_DMA_MAX_SECTORS)
+        return 5;
+    prd[n - 1].flags = IDE_PRD_EOT;
+
+    bm_write(channel, ATA_BM_COMMAND, 0);
+    outl(channels[channel].bmide + ATA_BM_PRDT, (uint32_t)prd);
+    bm_write(channel, ATA_BM_COMMAND, dir);
+    bm_write(channel, ATA_BM_STATUS,
+             bm_read(channel, ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+    int mode = ide_select_lba(drive, lba, numsects, op == IDE_OP_WRITE_FUA);
+    if (!mode) return 5;
+
+    ide_irq_arm(channel);
+    if (op == IDE_OP_WRITE_FUA)
+        ide_write(channel, ATA_REG_COMMAND, ATA_CMD_WRITE_DMA_FUA_EXT);
+    else if (op == IDE_OP_WRITE)
+        ide_write(channel, ATA_REG_COMMAND, mode == 2 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+    else
+        ide_write(channel, ATA_REG_COMMAND, mode == 2 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+
+    compiler_barrier();     // Port writes are ordered after earlier stores
+    bm_write(channel, ATA_BM_COMMAND, dir | ATA_BM_CMD_START);
+    return 0;
+}
+
+// The command is still moving data: the engine is running with no IRQ or
+// error latched, or the drive is busy. One look, for interrupt context.
+int ide_dma_busy(uint8_t drive) {
+    uint8_t channel = ide_devices[drive].Channel;
+    uint8_t bm = bm_read(channel, ATA_BM_STATUS);
+
+    if ((bm & (ATA_BM_SR_ACTIVE | ATA_BM_SR_ERR | ATA_BM_SR_IRQ)) == ATA_BM_SR_ACTIVE) return 1;
+    return (ide_read(channel, ATA_REG_ALTSTATUS) & ATA_SR_BSY) != 0;
+}
+
+// Stop the engine once the command is done and collect its status. On
+// failure the drive drops back to PIO for good and the caller retries the
+// request that way. The polls are bounded by IDE_DMA_POLL_LOOPS rather
+// than the clock, which does not tick while an IRQ handler runs.
+int ide_dma_finish(uint8_t drive, uint8_t op) {
+    uint8_t channel = ide_devices[drive].Channel;
+    uint8_t dir = op == IDE_OP_READ ? ATA_BM_CMD_READ : 0;
+    uint32_t loops = IDE_DMA_POLL_LOOPS;
+
+    // The engine drops ACTIVE once the last PRD is done
+    uint8_t bm;
+    do {
+        bm = bm_read(channel, ATA_BM_STATUS);
+    } while ((bm & ATA_BM_SR_ACTIVE) && !(bm & (ATA_BM_SR_ERR | ATA_BM_SR_IRQ)) && --loops);
+
+    uint8_t status;
+    while (((status = ide_read(channel, ATA_REG_STATUS)) & ATA_SR_BSY) && loops && --loops);
+
+    bm_write(channel, ATA_BM_COMMAND, dir);
+    bm_write(channel, ATA_BM_STATUS, bm | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+
+    int err = 0;
+    if (bm & ATA_BM_SR_ERR) err = 4;
+    else if ((status & ATA_SR_BSY) || (bm & (ATA_BM_SR_ACTIVE | ATA_BM_SR_IRQ)) == ATA_BM_SR_ACTIVE)
+        err = 6;                                // Timed out
+    else if (status & ATA_SR_ERR) err = 2;
+    else if (status & ATA_SR_DF) err = 1;
+
+    if (err) {
+        printf("IDE: DMA %s error %d on drive %d, falling back to PIO\n",
+               op == IDE_OP_READ ? "read" : "write", err, drive);
+        ide_devices[drive].Dma = 0;
+    }
+    return err;
+}
+
+// Synchronous DMA of one buffer: start, sleep until the IRQ, finish
+int ide_dma_transfer(uint8_t drive, uint8_t op, uint32_t lba, uint32_t numsects, void *buf) {
+    struct ide_sg sg = { buf, numsects };
+    int err;
+
+    if ((err = ide_dma_start(drive, op, lba, &sg, 1)))
+        return err;
+
+    if (!channels[ide_devices[drive].Channel].nIEN)
+        ide_wait_irq(ide_devices[drive].Channel);
+
+    return ide_dma_finish(drive, op);
+}
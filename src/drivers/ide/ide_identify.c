@@ -1,5 +1,5 @@
 #include <ide.h>
-#include <timer.h>
+#include <clock.h>
 #include <commands.h>
 
 /* ============================================================================
@@ -11,13 +11,13 @@ void ide_identify(uint8_t channel, uint8_t drive) {
     uint16_t io = channels[channel].base;
 
     ide_write(channel, ATA_REG_HDDEVSEL, 0xA0 | (dev << 4));
-    timer_wait_ms(1);
+    ide_delay(channel);
     ide_write(channel, ATA_REG_SECCOUNT0, 0);
     ide_write(channel, ATA_REG_LBA0, 0);
     ide_write(channel, ATA_REG_LBA1, 0);
     ide_write(channel, ATA_REG_LBA2, 0);
     ide_write(channel, ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
-    timer_wait_ms(1);
+    ide_delay(channel);
 
     if (ide_read(channel, ATA_REG_STATUS) == 0) return;
 
@@ -29,17 +29,116 @@ void ide_identify(uint8_t channel, uint8_t drive) {
 
     insw(io, ide_buf, 256);
 
-    ide_devices[drive].Reserved     = 1;
-    ide_devices[drive].Channel      = channel;
-    ide_devices[drive].Drive        = dev;
-    ide_devices[drive].Signature    = *((uint16_t *)(ide_buf + 0));
-    ide_devices[drive].Capabilities = *((uint16_t *)(ide_buf + 98));
-    ide_devices[drive].CommandSets  = *((uint32_t *)(ide_buf + 164));
-    ide_devices[drive].Size         = *((uint32_t *)(ide_buf + 120));
+    struct ide_device *d = &ide_devices[channel * 2 + dev];
+    const uint16_t *id = (const uint16_t *)ide_buf;
+
+    d->Reserved     = 1;
+    d->Channel      = channel;
+    d->Drive        = dev;
+    d->Signature    = id[ATA_IDENT_DEVICETYPE];
+    d->Capabilities = id[ATA_IDENT_CAPABILITIES];
+    d->CommandSets  = *((uint32_t *)(ide_buf + 164));
+    d->Size         = *((uint32_t *)(ide_buf + 120));
+    d->Lba48        = (d->CommandSets & ATA_CMDSET_LBA48) != 0;
+    d->Fua          = d->Lba48 && (id[ATA_IDENT_CMDSET_EXT] & ATA_CMDSET_EXT_FUA);
+
+    // Words 100-103 hold the LBA48 capacity
+    if (d->Lba48) {
+        uint32_t lo = *((uint32_t *)(ide_buf + 200));
+        uint32_t hi = *((uint32_t *)(ide_buf + 204));
+        d->Size = hi ? 0xFFFFFFFF : lo;
+    }
+
+    // Transfer modes; words 64-70 and 88 are only meaningful when word 53 says so
+    d->MultipleMax = id[ATA_IDENT_MAX_MULTIPLE] & 0xFF;
+    d->Multiple    = 0;
+    d->PioModes    = 0x07;      // Modes 0-2 are mandatory
+    d->MwdmaModes  = (d->Capabilities & ATA_CAP_DMA) ? id[ATA_IDENT_MWDMA] & 0x07 : 0;
+    d->UdmaModes   = 0;
+    if (id[ATA_IDENT_FIELD_VALID] & ATA_VALID_64_70)
+        d->PioModes |= (id[ATA_IDENT_PIO_MODES] & 0x03) << 3;
+    if (id[ATA_IDENT_FIELD_VALID] & ATA_VALID_88)
+        d->UdmaModes = id[ATA_IDENT_UDMA] & 0x7F;
+    d->PioMode  = 0;
+    d->DmaMode  = 0;
 
     for (int k = 0; k < 40; k += 2) {
-        ide_devices[drive].Model[k] = ide_buf[54 + k + 1];
-        ide_devices[drive].Model[k + 1] = ide_buf[54 + k];
+        d->Model[k] = ide_buf[54 + k + 1];
+        d->Model[k + 1] = ide_buf[54 + k];
+    }
+    d->Model[40] = '\0';
+}
+
+/* ============================================================================
+ * MODE NEGOTIATION
+ * ============================================================================ */
+
+static int highest_mode(uint8_t mask) {
+    return mask ? 31 - __builtin_clz(mask) : -1;
+}
+
+// Issue a command without a data phase and wait for it to complete
+static int ide_nondata_command(uint8_t drive, uint8_t command, uint8_t features, uint8_t count) {
+    uint8_t channel = ide_devices[drive].Channel;
+
+    ide_write(channel, ATA_REG_HDDEVSEL, 0xA0 | (ide_devices[drive].Drive << 4));
+    ide_delay(channel);
+    ide_write(channel, ATA_REG_FEATURES, features);
+    ide_write(channel, ATA_REG_SECCOUNT0, count);
+    ide_irq_arm(channel);
+    ide_write(channel, ATA_REG_COMMAND, command);
+    ide_wait(channel, 0);
+
+    return (ide_read(channel, ATA_REG_STATUS) & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+}
+
+// Pick the READ/WRITE MULTIPLE block size with SET MULTIPLE. On a PIIX,
+// whose timing registers are known, also move the drive to the fastest
+// PIO and DMA modes both sides support and time the controller to match.
+// Elsewhere the drive stays in the mode the firmware left it in, which the
+// controller is already timed for.
+void ide_configure(uint8_t drive) {
+    struct ide_device *d = &ide_devices[drive];
+
+    // Largest power-of-two block the drive accepts, up to 16 sectors
+    uint8_t block = d->MultipleMax < IDE_MULTIPLE_MAX ? d->MultipleMax : IDE_MULTIPLE_MAX;
+    if (block >= 2) {
+        block = 1u << highest_mode(block);
+        if (ide_nondata_command(drive, ATA_CMD_SET_MULTIPLE, 0, block) == 0)
+            d->Multiple = block;
     }
-    ide_devices[drive].Model[40] = '\0';
-}
\ No newline at end of file
+
+    if (!ide_piix_present()) return;
+
+    int pio = highest_mode(d->PioModes);
+    int udma = highest_mode(d->UdmaModes & ide_piix_udma_modes());
+    int mwdma = highest_mode(d->MwdmaModes);
+    uint8_t dma = 0;
+
+    if (d->Dma) {
+        if (udma >= 0) {
+            dma = ATA_XFER_UDMA | udma;
+        } else if (mwdma >= 0) {
+            // Multiword DMA and PIO share one channel timing
+            dma = ATA_XFER_MWDMA | mwdma;
+            if (pio > ide_piix_mwdma_pio(mwdma)) pio = ide_piix_mwdma_pio(mwdma);
+        } else {
+            d->Dma = 0;
+        }
+    }
+
+    // A refused mode leaves the drive, and so the controller, as they were
+    if (ide_nondata_command(drive, ATA_CMD_SET_FEATURES, ATA_FEAT_XFER_MODE,
+                            ATA_XFER_PIO_FLOW | pio) != 0)
+        return;
+    d->PioMode = ATA_XFER_PIO_FLOW | pio;
+
+    if (dma && ide_nondata_command(drive, ATA_CMD_SET_FEATURES, ATA_FEAT_XFER_MODE, dma) == 0) {
+        d->DmaMode = dma;
+    } else if (dma) {
+        d->Dma = 0;
+        dma = 0;
+    }
+
+    ide_piix_set_modes(drive, pio, dma);
+}
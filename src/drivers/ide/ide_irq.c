@@ -0,0 +1,87 @@
+#include <ide.h>
+#include <idt.h>
+#include <cpu.h>
+#include <clock.h>
+#include <commands.h>
+
+/* ============================================================================
+ * INTERRUPT HANDLERS
+ * ============================================================================ */
+
+// Reading STATUS acknowledges the drive's INTRQ; the bus master IRQ bit is
+// left set for the DMA path to check and clear
+static void ide_irq(uint8_t channel) {
+    struct ide_channel *ch = &channels[channel];
+
+    if (ch->bmide) ch->irq_bm_status = inb(ch->bmide + ATA_BM_STATUS);
+    ch->irq_status = inb(ch->base + ATA_REG_STATUS);
+    ch->irq_fired = 1;
+    ch->irq_count++;
+
+    if (ch->irq_hook) ch->irq_hook(channel);
+}
+
+static void ide_irq_primary(void) {
+    ide_irq(ATA_PRIMARY);
+}
+
+static void ide_irq_secondary(void) {
+    ide_irq(ATA_SECONDARY);
+}
+
+/* ============================================================================
+ * COMPLETION
+ * ============================================================================ */
+
+// Unmask the drive interrupt on a channel, registering the handlers first
+void ide_set_irq(uint8_t channel, int enable) {
+    static int installed = 0;
+
+    if (enable && !installed) {
+        install_irq_handler(IDE_IRQ_PRIMARY, ide_irq_primary);
+        install_irq_handler(IDE_IRQ_SECONDARY, ide_irq_secondary);
+        installed = 1;
+    }
+
+    channels[channel].nIEN = enable ? 0 : ATA_CTRL_NIEN;
+    ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN);
+    channels[channel].irq_fired = 0;
+}
+
+// Forget any earlier interrupt; call before issuing a command
+void ide_irq_arm(uint8_t channel) {
+    channels[channel].irq_fired = 0;
+}
+
+// Sleep with hlt until the channel interrupts. Falls back to the status
+// register when interrupts are off or the IRQ never arrives.
+uint8_t ide_wait_irq(uint8_t channel) {
+    struct ide_channel *ch = &channels[channel];
+    unsigned long flags = save_and_cli();
+
+    if (ch->nIEN || !(flags & EFLAGS_IF) || irq_nesting) {
+        restore_flags(flags);
+        return ide_read(channel, ATA_REG_STATUS);
+    }
+
+    uint64_t deadline = ktime_ns() + IDE_IRQ_TIMEOUT_MS * 1000000ull;
+    uint64_t start = rdtsc();
+
+    // sti only takes effect after hlt, so the IRQ cannot slip in between
+    while (!ch->irq_fired && ktime_ns() < deadline)
+        asm volatile ("sti; hlt; cli" ::: "memory");
+
+    ch->sleep_cycles += rdtsc() - start;
+
+    uint8_t status;
+    if (ch->irq_fired) {
+        ch->irq_fired = 0;
+        status = ch->irq_status;
+    } else {
+        ch->irq_timeouts++;
+        status = ide_read(channel, ATA_REG_STATUS);
+    }
+
+    restore_flags(flags);
+    return status;
+}
@@ -0,0 +1,99 @@
+#include <ide.h>
+#include <pci.h>
+
+/*
+ * Timing registers of the Intel PIIX3/PIIX4 IDE function. A drive put in a
+ * faster mode with SET FEATURES only works once the controller is timed
+ * for the same mode, so ide_configure raises modes only on these parts.
+ */
+
+#define PIIX_VENDOR         0x8086
+#define PIIX3_IDE           0x7010
+#define PIIX4_IDE           0x7111
+
+#define PIIX_IDETIM         0x40    // Primary channel; secondary at 0x42
+#define PIIX_SIDETIM        0x44    // Slave timings when SITRE is set
+#define PIIX_UDMACTL        0x48    // PIIX4: one enable bit per drive
+#define PIIX_UDMATIM        0x4A    // PIIX4: UDMA mode, four bits per drive
+
+#define PIIX_IDETIM_SITRE   0x4000
+#define PIIX_TIME_FAST      0x01    // Fast timing bank
+#define PIIX_TIME_IORDY     0x02    // Sample IORDY
+#define PIIX_TIME_PREFETCH  0x04    // Prefetch and posting, ATA drives only
+
+static struct pci_device piix;
+static int piix_found;
+static uint8_t piix_udma;           // UDMA modes the controller can time
+
+// IORDY sample point and recovery time for each PIO mode, as IDETIM encodes them
+static const uint8_t piix_pio_timing[5][2] = { {0, 0}, {0, 0}, {1, 0}, {2, 1}, {2, 3} };
+
+// Multiword DMA runs on the PIO timing of a matching mode
+static const uint8_t piix_mwdma_pio[3] = { 0, 3, 4 };
+
+int ide_piix_init(const struct pci_device *dev) {
+    if (dev->vendor != PIIX_VENDOR) return -1;
+
+    if (dev->device == PIIX3_IDE) piix_udma = 0;
+    else if (dev->device == PIIX4_IDE) piix_udma = 0x07;     // UDMA/33
+    else return -1;
+
+    piix = *dev;
+    piix_found = 1;
+    return 0;
+}
+
+int ide_piix_present(void) {
+    return piix_found;
+}
+
+uint8_t ide_piix_udma_modes(void) {
+    return piix_udma;
+}
+
+// Fastest PIO mode whose timing also suits multiword DMA mode mwdma
+int ide_piix_mwdma_pio(int mwdma) {
+    return piix_mwdma_pio[mwdma];
+}
+
+// Time the drive's channel for PIO mode pio, which multiword DMA shares,
+// and enable UDMA for it when dma is a UDMA mode
+void ide_piix_set_modes(uint8_t drive, int pio, uint8_t dma) {
+    uint8_t channel = ide_devices[drive].Channel;
+    uint8_t slave = ide_devices[drive].Drive;
+    uint8_t reg = PIIX_IDETIM + channel * 2;
+    uint16_t idetim = pci_read16(&piix, reg);
+    uint16_t isp = piix_pio_timing[pio][0];
+    uint16_t rtc = piix_pio_timing[pio][1];
+    uint16_t control = PIIX_TIME_PREFETCH;
+
+    if (pio >= 2) control |= PIIX_TIME_FAST;
+    if (pio >= 3) control |= PIIX_TIME_IORDY;
+
+    if (slave) {
+        uint8_t shift = channel ? 4 : 0;
+        uint16_t sidetim = pci_read16(&piix, PIIX_SIDETIM);
+
+        sidetim = (uint16_t)((sidetim & ~(0x0F << shift)) | ((isp << 2 | rtc) << shift));
+        pci_write16(&piix, PIIX_SIDETIM, sidetim);
+        idetim = (uint16_t)((idetim & 0xFF0F) | control << 4 | PIIX_IDETIM_SITRE);
+    } else {
+        idetim = (uint16_t)((idetim & 0xCCF0) | control | isp << 12 | rtc << 8);
+    }
+    pci_write16(&piix, reg, idetim);
+
+    if (!piix_udma) return;
+
+    uint8_t bit = channel * 2 + slave;
+    uint16_t udmactl = pci_read16(&piix, PIIX_UDMACTL);
+    uint16_t udmatim = pci_read16(&piix, PIIX_UDMATIM);
+
+    if ((dma & 0xF8) == ATA_XFER_UDMA) {
+        udmactl |= 1u << bit;
+        udmatim = (uint16_t)((udmatim & ~(0x3u << bit * 4)) | (dma & 0x07) << bit * 4);
+    } else {
+        udmactl &= (uint16_t)~(1u << bit);
+    }
+    pci_write16(&piix, PIIX_UDMATIM, udmatim);
+    pci_write16(&piix, PIIX_UDMACTL, udmactl);
+}
@@ -1,39 +1,40 @@
 #include <ide.h>
 #include <commands.h>
+#include <clock.h>
 
 /* ============================================================================
  * LOW-LEVEL PORT I/O
  * ============================================================================ */
 
+// Task file registers sit at base; the HOB bytes of LBA48 share the same
+// ports, and control/alt-status live at ctrl
+static inline uint16_t ide_port(uint8_t channel, uint8_t reg) {
+    if (reg < 0x08) return channels[channel].base + reg;
+    if (reg < 0x0C) return channels[channel].base + reg - 0x06;
+    return channels[channel].ctrl + (reg - 0x0C);
+}
+
+// The alt-status read flushes posted writes before the 400 ns settle time
 void ide_delay(uint8_t channel) {
-    for (int i = 0; i < 4; i++) {
-        ide_read(channel, ATA_REG_ALTSTATUS);
-    }
+    ide_read(channel, ATA_REG_ALTSTATUS);
+    ndelay(ATA_SETTLE_NS);
 }
 
 uint8_t ide_read(uint8_t channel, uint8_t reg) {
-    if (reg > 0x07 && reg < 0x0C)
-        ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN | 0x02);
-    
-    uint16_t port = (reg < 0x08) ? channels[channel].base + reg
-                                 : channels[channel].ctrl + (reg - 0x08);
-    return inb(port);
+    if (reg > 0x07 && reg < 0x0C) {
+        ide_write(channel, ATA_REG_CONTROL, ATA_CTRL_HOB | channels[channel].nIEN);
+        uint8_t value = inb(ide_port(channel, reg));
+        ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN);
+        return value;
+    }
+
+    return inb(ide_port(channel, reg));
 }
 
 void ide_write(uint8_t channel, uint8_t reg, uint8_t data) {
-    if (reg > 0x07 && reg < 0x0C)
-        ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN | 0x02);
-
-    uint16_t port = (reg < 0x08) ? channels[channel].base + reg
-                                 : channels[channel].ctrl + (reg - 0x08);
-    outb(port, data);
+    outb(ide_port(channel, reg), data);
 }
 
 void ide_read_buffer(uint8_t channel, uint8_t reg, void *buffer, uint32_t quads) {
-    if (reg > 0x07 && reg < 0x0C)
-        ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN | 0x02);
-
-    uint16_t port = (reg < 0x08) ? channels[channel].base + reg
-                                 : channels[channel].ctrl + (reg - 0x08);
-    insw(port, buffer, quads);
-}
\ No newline at end of file
+    insw(ide_port(channel, reg), buffer, quads);
+}
@@ -1,8 +1,7 @@
 #include <ide.h>
 
 uint8_t ide_polling(uint8_t channel, uint8_t check) {
-    for (int i = 0; i < 4; i++)
-        ide_read(channel, ATA_REG_ALTSTATUS);
+    ide_delay(channel);
 
     while (ide_read(channel, ATA_REG_STATUS) & ATA_SR_BSY);
 
@@ -15,4 +14,11 @@ uint8_t ide_polling(uint8_t channel, uint8_t check) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Wait for the next step of a command: sleep on the channel IRQ when it is
+// enabled, then check the status the same way ide_polling does
+uint8_t ide_wait(uint8_t channel, uint8_t check) {
+    if (!channels[channel].nIEN) ide_wait_irq(channel);
+    return ide_polling(channel, check);
+}
@@ -1,63 +1,156 @@
 #include <ide.h>
 #include <commands.h>
-#include <timer.h>
 
 #define SECTOR_SIZE_BYTES 512
 
 /* ============================================================================
- * SECTOR READ
+ * TASK FILE
  * ============================================================================ */
 
-int ide_read_sectors(uint8_t drive, uint8_t numsects, uint32_t lba, void *buf) {
-    if (drive > 3 || !ide_devices[drive].Reserved)
-        return 1;
+// Largest command the drive can take: 256 sectors in LBA28, 65536 in LBA48,
+// and no more than one PRD table's worth when the drive uses DMA
+uint32_t ide_max_sectors(uint8_t drive) {
+    uint32_t max = ide_devices[drive].Lba48 ? 65536 : 256;
+    if (ide_devices[drive].Dma && max > IDE_DMA_MAX_SECTORS)
+        max = IDE_DMA_MAX_SECTORS;
+    return max;
+}
 
+// Select the drive and load LBA and count. Uses LBA28 whenever the request
+// fits in it and lba48 is not forced; returns the addressing mode
+// (1 = LBA28, 2 = LBA48) or 0 when the drive cannot address the range.
+int ide_select_lba(uint8_t drive, uint32_t lba, uint32_t numsects, int lba48) {
     uint8_t channel = ide_devices[drive].Channel;
     uint8_t slavebit = ide_devices[drive].Drive;
-    uint16_t bus = channels[channel].base;
-    uint8_t lba_mode = 0;
 
-    uint8_t lba_io[6];
-    uint8_t head;
+    if (numsects == 0 || lba >= ide_devices[drive].Size || numsects > ide_devices[drive].Size - lba)
+        return 0;
+
+    if (!lba48 && numsects <= 256 && lba < ATA_LBA28_LIMIT && numsects <= ATA_LBA28_LIMIT - lba) {
+        ide_write(channel, ATA_REG_HDDEVSEL, 0xE0 | (slavebit << 4) | ((lba >> 24) & 0x0F));
+        ide_delay(channel);
+
+        ide_write(channel, ATA_REG_SECCOUNT0, (uint8_t)numsects);     // 256 is sent as 0
+        ide_write(channel, ATA_REG_LBA0, (lba >> 0) & 0xFF);
+        ide_write(channel, ATA_REG_LBA1, (lba >> 8) & 0xFF);
+        ide_write(channel, ATA_REG_LBA2, (lba >> 16) & 0xFF);
+        return 1;
+    }
+
+    if (!ide_devices[drive].Lba48 || numsects > 65536)
+        return 0;
+
+    ide_write(channel, ATA_REG_HDDEVSEL, 0x40 | (slavebit << 4));
+    ide_delay(channel);
+
+    // Each register is a two-deep FIFO: high-order bytes go in first
+    ide_write(channel, ATA_REG_SECCOUNT1, (numsects >> 8) & 0xFF);     // 65536 is sent as 0
+    ide_write(channel, ATA_REG_LBA3, (lba >> 24) & 0xFF);
+    ide_write(channel, ATA_REG_LBA4, 0);
+    ide_write(channel, ATA_REG_LBA5, 0);
+    ide_write(channel, ATA_REG_SECCOUNT0, numsects & 0xFF);
+    ide_write(channel, ATA_REG_LBA0, (lba >> 0) & 0xFF);
+    ide_write(channel, ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    ide_write(channel, ATA_REG_LBA2, (lba >> 16) & 0xFF);
+    return 2;
+}
+
+/* ============================================================================
+ * PIO TRANSFER
+ * ============================================================================ */
+
+// Select the drive, load the task file and issue the PIO command; the data
+// phase is left to the caller. Uses READ/WRITE MULTIPLE when a block size
+// has been negotiated.
+int ide_pio_command(uint8_t drive, uint8_t op, uint32_t lba, uint32_t numsects) {
+    uint8_t channel = ide_devices[drive].Channel;
+    uint32_t block = ide_pio_block(drive);
+
+    int mode = ide_select_lba(drive, lba, numsects, op == IDE_OP_WRITE_FUA);
+    if (!mode) return 3;
+
+    uint8_t command;
+    if (op == IDE_OP_WRITE_FUA)
+        command = ATA_CMD_WRITE_MULTIPLE_FUA_EXT;
+    else if (block > 1 && op == IDE_OP_WRITE)
+        command = mode == 2 ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+    else if (block > 1)
+        command = mode == 2 ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
+    else if (op == IDE_OP_WRITE)
+        command = mode == 2 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+    else
+        command = mode == 2 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+
+    ide_irq_arm(channel);
+    ide_write(channel, ATA_REG_COMMAND, command);
+    return 0;
+}
 
-    uint16_t i;
+static int ide_pio_transfer(uint8_t drive, uint8_t op, uint32_t lba, uint32_t numsects, void *buf) {
+    uint8_t channel = ide_devices[drive].Channel;
+    uint16_t bus = channels[channel].base;
+    uint8_t *data = (uint8_t *)buf;
+    uint32_t block = ide_pio_block(drive);
     uint8_t err;
 
-    if (lba >= 0x10000000) {
-        lba_mode = 2;
-        lba_io[0] = (lba & 0x000000FF) >> 0;
-        lba_io[1] = (lba & 0x0000FF00) >> 8;
-        lba_io[2] = (lba & 0x00FF0000) >> 16;
-        lba_io[3] = (lba & 0xFF000000) >> 24;
-        lba_io[4] = 0;
-        lba_io[5] = 0;
-        head = 0;
-    } else {
-        lba_mode = 1;
-        lba_io[0] = (lba >> 0) & 0xFF;
-        lba_io[1] = (lba >> 8) & 0xFF;
-        lba_io[2] = (lba >> 16) & 0xFF;
-        lba_io[3] = (lba >> 24) & 0x0F;
-        lba_io[4] = 0;
-        lba_io[5] = 0;
-        head = (lba >> 24) & 0x0F;
+    if (ide_pio_command(drive, op, lba, numsects)) return 3;
+
+    if (op == IDE_OP_READ) {
+        // The drive interrupts once per block when its data is ready
+        for (uint32_t i = 0; i < numsects; i += block) {
+            uint32_t n = numsects - i < block ? numsects - i : block;
+            if ((err = ide_wait(channel, 1))) return err;
+            insw(bus, data + i * SECTOR_SIZE_BYTES, n * 256);
+        }
+        return 0;
     }
 
-    ide_write(channel, ATA_REG_HDDEVSEL, 0xE0 | (slavebit << 4) | head);
-    timer_wait_ms(1);
+    // No interrupt for the first block; each later one, and the end of
+    // the command, is announced by an IRQ
+    for (uint32_t i = 0; i < numsects; i += block) {
+        uint32_t n = numsects - i < block ? numsects - i : block;
+        if ((err = i ? ide_wait(channel, 0) : ide_polling(channel, 0))) return err;
+        outsw(bus, data + i * SECTOR_SIZE_BYTES, n * 256);
+    }
+    return ide_wait(channel, 0);
+}
 
-    ide_write(channel, ATA_REG_SECCOUNT0, numsects);
-    ide_write(channel, ATA_REG_LBA0, lba_io[0]);
-    ide_write(channel, ATA_REG_LBA1, lba_io[1]);
-    ide_write(channel, ATA_REG_LBA2, lba_io[2]);
-    ide_write(channel, ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+// One command's worth of sectors, by DMA when possible. PIO has no FUA
+// command for single-sector blocks, so that case writes and then flushes.
+static int ide_transfer(uint8_t drive, uint8_t op, uint32_t lba, uint32_t numsects, void *buf) {
+    if (ide_dma_usable(drive, buf, numsects * SECTOR_SIZE_BYTES) &&
+        ide_dma_transfer(drive, op, lba, numsects, buf) == 0)
+        return 0;
 
-    for (i = 0; i < numsects; i++) {
-        if ((err = ide_polling(channel, 1))) return err;
-        insw(bus, (uint16_t *)((uint8_t *)buf + i * 512), 256);
+    if (op == IDE_OP_WRITE_FUA && ide_devices[drive].Multiple < 2) {
+        int ret = ide_pio_transfer(drive, IDE_OP_WRITE, lba, numsects, buf);
+        return ret ? ret : ide_flush_cache(drive);
     }
 
-    (void)lba_mode;
+    return ide_pio_transfer(drive, op, lba, numsects, buf);
+}
+
+/* ============================================================================
+ * SECTOR READ
+ * ============================================================================ */
+
+int ide_read_sectors(uint8_t drive, uint32_t numsects, uint32_t lba, void *buf) {
+    if (drive > 3 || !ide_devices[drive].Reserved)
+        return 1;
+
+    uint8_t *data = (uint8_t *)buf;
+    int ret;
+
+    while (numsects) {
+        uint32_t n = ide_max_sectors(drive);
+        if (n > numsects) n = numsects;
+
+        if ((ret = ide_transfer(drive, 0, lba, n, data))) return ret;
+
+        data += n * SECTOR_SIZE_BYTES;
+        lba += n;
+        numsects -= n;
+    }
 
     return 0;
 }
@@ -66,7 +159,7 @@ int ide_read_sectors(uint8_t drive, uint8_t numsects, uint32_t lba, void *buf) {
  * SECTOR WRITE
  * ============================================================================ */
 
-int ide_write_sectors_counted(uint8_t drive, uint32_t start_lba, size_t byte_count, const void *buf) {
+static int ide_write_sectors_op(uint8_t drive, uint8_t op, uint32_t start_lba, size_t byte_count, const void *buf) {
     if (drive > 3 || !ide_devices[drive].Reserved)
         return 1;
 
@@ -76,94 +169,59 @@ int ide_write_sectors_counted(uint8_t drive, uint32_t start_lba, size_t byte_cou
     if (byte_count % 512)
         return 2;
 
-    size_t total_sectors = byte_count / 512;
-    const uint8_t *data = (const uint8_t *)buf;
-    size_t sectors_written = 0;
-    size_t sectors_remaining = total_sectors;
+    uint32_t sectors_remaining = byte_count / SECTOR_SIZE_BYTES;
+    uint8_t *data = (uint8_t *)buf;
     uint32_t lba = start_lba;
     int ret;
 
-    const uint32_t LBA28_MAX = 0x0FFFFFFF;
-
     while (sectors_remaining) {
-        if (lba > LBA28_MAX) return 3;
-
-        uint8_t n = (sectors_remaining >= 256) ? 0 : (uint8_t)sectors_remaining;
-
-        uint8_t channel = ide_devices[drive].Channel;
-        uint8_t slavebit = ide_devices[drive].Drive;
-        uint16_t bus = channels[channel].base;
-        uint8_t lba_io[6];
-        uint8_t head;
-
-        lba_io[0] = (lba >> 0) & 0xFF;
-        lba_io[1] = (lba >> 8) & 0xFF;
-        lba_io[2] = (lba >> 16) & 0xFF;
-        lba_io[3] = (lba >> 24) & 0x0F;
-        lba_io[4] = 0;
-        lba_io[5] = 0;
-        head = (lba >> 24) & 0x0F;
-
-        ide_write(channel, ATA_REG_HDDEVSEL, 0xE0 | (slavebit << 4) | head);
-        timer_wait_ms(1);
-
-        ide_write(channel, ATA_REG_SECCOUNT0, n);
-        ide_write(channel, ATA_REG_LBA0, lba_io[0]);
-        ide_write(channel, ATA_REG_LBA1, lba_io[1]);
-        ide_write(channel, ATA_REG_LBA2, lba_io[2]);
-        ide_write(channel, ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-
-        uint16_t sectors_to_transfer = (n == 0) ? 256 : n;
-        for (uint16_t i = 0; i < sectors_to_transfer; i++) {
-            uint8_t err;
-            if ((err = ide_polling(channel, 0))) return err;
-            outsw(bus, (const uint16_t *)(data + (sectors_written + i) * 512), 256);
-        }
+        uint32_t n = ide_max_sectors(drive);
+        if (n > sectors_remaining) n = sectors_remaining;
 
-        ide_write(channel, ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-        if ((ret = ide_polling(channel, 0))) return ret;
+        if ((ret = ide_transfer(drive, op, lba, n, data))) return ret;
 
-        sectors_written += sectors_to_transfer;
-        sectors_remaining -= sectors_to_transfer;
-        lba += sectors_to_transfer;
+        data += n * SECTOR_SIZE_BYTES;
+        sectors_remaining -= n;
+        lba += n;
     }
 
     return 0;
 }
 
-uint32_t find_next_free_lba(uint8_t drive) {
-    extern struct ide_device ide_devices[4];
-
-    if (drive >= 4) return UINT32_MAX;
-    if (!ide_devices[drive].Reserved) return UINT32_MAX;
+// Plain write into the drive's cache; durability needs ide_flush_cache()
+int ide_write_sectors_counted(uint8_t drive, uint32_t start_lba, size_t byte_count, const void *buf) {
+    return ide_write_sectors_op(drive, IDE_OP_WRITE, start_lba, byte_count, buf);
+}
 
-    uint32_t size = ide_devices[drive].Size;
-    if (size == 0) return UINT32_MAX;
+// Write that is on the medium when it returns. Uses the FUA commands when
+// the drive has them, otherwise a plain write followed by a cache flush.
+int ide_write_sectors_fua(uint8_t drive, uint32_t start_lba, size_t byte_count, const void *buf) {
+    if (drive > 3 || !ide_devices[drive].Reserved)
+        return 1;
 
-    uint8_t buf[512];
-    int seen_used = 0;
-    uint32_t last_used_lba = 0xFFFFFFFF;
+    if (ide_devices[drive].Fua)
+        return ide_write_sectors_op(drive, IDE_OP_WRITE_FUA, start_lba, byte_count, buf);
 
-    for (uint32_t lba = 0; lba < size; ++lba) {
-        if (ide_read_sectors(drive, 1, lba, buf) != 0) {
-            return UINT32_MAX;
-        }
+    int ret = ide_write_sectors_op(drive, IDE_OP_WRITE, start_lba, byte_count, buf);
+    return ret ? ret : ide_flush_cache(drive);
+}
 
-        int all_zero = 1;
-        for (size_t i = 0; i < sizeof(buf); ++i) {
-            if (buf[i] != 0) {
-                all_zero = 0;
-                break;
-            }
-        }
+int ide_flush_cache(uint8_t drive) {
+    if (drive > 3 || !ide_devices[drive].Reserved)
+        return 1;
 
-        if (!all_zero) {
-            seen_used = 1;
-            last_used_lba = lba;
-        }
-    }
+    uint8_t channel = ide_devices[drive].Channel;
 
-    if (!seen_used) return 0;            /* no used sectors, next free is LBA 0 */
-    if (last_used_lba == size - 1) return UINT32_MAX; /* no free space after last used */
-    return last_used_lba + 1;            /* start sector of the next free */
+    ide_write(channel, ATA_REG_HDDEVSEL, 0xA0 | (ide_devices[drive].Drive << 4));
+    ide_delay(channel);
+    ide_irq_arm(channel);
+    ide_write(channel, ATA_REG_COMMAND, ide_devices[drive].Lba48 ? ATA_CMD_CACHE_FLUSH_EXT
+                                                                 : ATA_CMD_CACHE_FLUSH);
+    uint8_t err = ide_wait(channel, 0);
+    if (err) return err;
+
+    // Still busy means the flush never finished, so nothing is durable yet
+    uint8_t status = ide_read(channel, ATA_REG_STATUS);
+    if (status & ATA_SR_BSY) return 6;
+    return (status & (ATA_SR_ERR | ATA_SR_DF)) ? 2 : 0;
 }
\ No newline at end of file
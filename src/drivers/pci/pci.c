@@ -0,0 +1,75 @@
+#include <pci.h>
+#include <commands.h>
+
+/* ============================================================================
+ * CONFIGURATION SPACE
+ * ============================================================================ */
+
+static inline void pci_select(const struct pci_device *dev, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, 0x80000000u | ((uint32_t)dev->bus << 16) |
+                             ((uint32_t)dev->slot << 11) | ((uint32_t)dev->func << 8) |
+                             (offset & 0xFC));
+}
+
+uint32_t pci_read32(const struct pci_device *dev, uint8_t offset) {
+    pci_select(dev, offset);
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint16_t pci_read16(const struct pci_device *dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(const struct pci_device *dev, uint8_t offset) {
+    return (uint8_t)(pci_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(const struct pci_device *dev, uint8_t offset, uint32_t value) {
+    pci_select(dev, offset);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_write16(const struct pci_device *dev, uint8_t offset, uint16_t value) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t dword = pci_read32(dev, offset);
+    dword = (dword & ~(0xFFFFu << shift)) | ((uint32_t)value << shift);
+    pci_write32(dev, offset, dword);
+}
+
+/* ============================================================================
+ * ENUMERATION
+ * ============================================================================ */
+
+// Brute-force scan for the first function with the given class and subclass
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device *out) {
+    struct pci_device dev;
+
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            uint8_t funcs = 1;
+
+            for (uint8_t func = 0; func < funcs; func++) {
+                dev.bus = (uint8_t)bus;
+                dev.slot = slot;
+                dev.func = func;
+
+                dev.vendor = pci_read16(&dev, PCI_VENDOR_ID);
+                if (dev.vendor == 0xFFFF) continue;
+
+                if (func == 0 && (pci_read8(&dev, PCI_HEADER_TYPE) & PCI_HEADER_MULTI))
+                    funcs = 8;
+
+                if (pci_read8(&dev, PCI_CLASS) != class_code ||
+                    pci_read8(&dev, PCI_SUBCLASS) != subclass)
+                    continue;
+
+                dev.device = pci_read16(&dev, PCI_DEVICE_ID);
+                dev.prog_if = pci_read8(&dev, PCI_PROG_IF);
+                *out = dev;
+                return 0;
+            }
+        }
+    }
+
+    return -1;
+}
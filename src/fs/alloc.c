@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <fs/elixir.h>
+#include <arena.h>
+#include <blk.h>
+#include <bcache.h>
+#include <bitops.h>
+#include <vga.h>
+
+struct run_search {
+    uint32_t n;
+    uint32_t hint;
+    uint32_t carry;     // Free bits at or after hint running up to the current node
+};
+
+// Bitmap word with the bits past the end of the disk reading as used
+static uint32_t bitmap_word(const struct block_bitmap *bb, uint32_t w) {
+    if (w * 32 >= bb->total) return 0xFFFFFFFFu;
+
+    uint32_t used = ((const uint32_t *)bb->bitmap)[w];
+    uint32_t valid = bb->total - w * 32;
+    if (valid < 32) used |= 0xFFFFFFFFu << valid;
+    return used;
+}
+
+/* ============================================================================
+ * SUMMARY
+ * ============================================================================ */
+
+static void run_leaf(struct block_bitmap *bb, uint32_t w) {
+    struct free_run *r = &bb->runs[bb->leaves + w];
+    uint32_t used = bitmap_word(bb, w);
+    uint32_t free = ~used;
+
+    bb->word_free[w] = (uint8_t)popcount32(free);
+    r->pre = used ? (uint32_t)__builtin_ctz(used) : 32;
+    r->suf = used ? (uint32_t)__builtin_clz(used) : 32;
+
+    // A full or empty word needs no scan for its longest run
+    if (bb->word_free[w] == 0 || bb->word_free[w] == 32) {
+        r->best = bb->word_free[w];
+        return;
+    }
+
+    // Each step shortens every run of ones by one
+    r->best = 0;
+    while (free) {
+        free &= free >> 1;
+        r->best++;
+    }
+}
+
+// half is the number of bits under each child
+static void run_combine(struct block_bitmap *bb, uint32_t node, uint32_t half) {
+    const struct free_run *l = &bb->runs[2 * node];
+    const struct free_run *r = &bb->runs[2 * node + 1];
+    struct free_run *p = &bb->runs[node];
+    uint32_t span = l->suf + r->pre;
+
+    p->pre = l->pre == half ? half + r->pre : l->pre;
+    p->suf = r->suf == half ? half + l->suf : r->suf;
+    p->best = l->best > r->best ? l->best : r->best;
+    if (span > p->best) p->best = span;
+}
+
+static void run_update(struct block_bitmap *bb, uint32_t w) {
+    uint32_t half = 32;
+
+    run_leaf(bb, w);
+    for (uint32_t node = (bb->leaves + w) / 2; node; node /= 2, half *= 2)
+        run_combine(bb, node, half);
+}
+
+static int alloc_attach(struct arena *arena, uint8_t drive, struct block_bitmap *bb) {
+    uint32_t words = (bb->total + 31) / 32;
+    uint32_t leaves = 1;
+    while (leaves < words) leaves *= 2;
+
+    bb->leaves = leaves;
+    bb->word_free = arena_alloc(arena, leaves);
+    bb->runs = arena_alloc(arena, 2 * leaves * sizeof(struct free_run));
+    if (!bb->word_free || !bb->runs) {
+        printf("Error: no memory for the allocation summary of drive %u\n", (unsigned)drive);
+        return -1;
+    }
+
+    for (uint32_t w = 0; w < leaves; w++)
+        run_leaf(bb, w);
+    for (uint32_t node = leaves - 1; node; node--)
+        run_combine(bb, node, (32u * leaves >> (31 - __builtin_clz(node))) / 2);
+
+    return 0;
+}
+
+// The bitmap and its summary, loaded the first time a mount allocates
+static struct block_bitmap *alloc_bitmap(uint8_t drive) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m) return NULL;
+
+    if (!m->bb && elixir_read_bitmap(m->arena, drive, m->sb, &m->bb) != 0) {
+        printf("Error: failed to read the block bitmap of drive %u\n", (unsigned)drive);
+        m->bb = NULL;
+        return NULL;
+    }
+    if (!m->bb->runs && alloc_attach(m->arena, drive, m->bb) != 0)
+        return NULL;
+    return m->bb;
+}
+
+/* ============================================================================
+ * SEARCH
+ * ============================================================================ */
+
+// First run of s->n free bits starting at or after s->hint, scanning left to
+// right. Subtrees wholly before the hint or too fragmented to hold the run
+// are passed over using their summary, so only O(log n) nodes are opened.
+static uint32_t run_find(const struct block_bitmap *bb, struct run_search *s,
+                         uint32_t node, uint32_t lo, uint32_t len) {
+    const struct free_run *r = &bb->runs[node];
+
+    if (lo + len <= s->hint) return UINT32_MAX;
+
+    if (lo >= s->hint) {
+        if (s->carry + r->pre >= s->n) return lo - s->carry;
+        if (r->best < s->n) {
+            s->carry = r->pre == len ? s->carry + len : r->suf;
+            return UINT32_MAX;
+        }
+    }
+
+    if (node >= bb->leaves) {
+        uint32_t w = node - bb->leaves;
+        uint32_t first = s->hint > lo ? s->hint - lo : 0;
+
+        // Words with nothing or everything free are settled by their count
+        if (bb->word_free[w] == 0) {
+            s->carry = 0;
+            return UINT32_MAX;
+        }
+        if (bb->word_free[w] == 32) {
+            if (s->carry + 32 - first >= s->n) return lo + first - s->carry;
+            s->carry += 32 - first;
+            return UINT32_MAX;
+        }
+
+        uint32_t used = bitmap_word(bb, w);
+        for (uint32_t bit = first; bit < 32; bit++) {
+            if (used & (1u << bit)) {
+                s->carry = 0;
+            } else if (++s->carry >= s->n) {
+                return lo + bit + 1 - s->carry;
+            }
+        }
+        return UINT32_MAX;
+    }
+
+    uint32_t start = run_find(bb, s, 2 * node, lo, len / 2);
+    if (start != UINT32_MAX) return start;
+    return run_find(bb, s, 2 * node + 1, lo + len / 2, len / 2);
+}
+
+/* ============================================================================
+ * ALLOCATION
+ * ============================================================================ */
+
+static void bitmap_set_range(struct block_bitmap *bb, uint32_t start, uint32_t n, int used) {
+    for (uint32_t bit = start; bit < start + n; bit++) {
+        if (used) bb->bitmap[bit / 8] |= (uint8_t)(1u << (bit % 8));
+        else bb->bitmap[bit / 8] &= (uint8_t)~(1u << (bit % 8));
+    }
+
+    for (uint32_t w = start / 32; w <= (start + n - 1) / 32; w++)
+        run_update(bb, w);
+    elixir_bitmap_dirty(bb, start, n);
+
+    if (used) {
+        bb->free_count -= n;
+        bb->used_count += n;
+    } else {
+        bb->free_count += n;
+        bb->used_count -= n;
+    }
+}
+
+// Write the dirty bitmap sectors and the new free count through the cache
+static int bitmap_store(uint8_t drive, struct block_bitmap *bb) {
+    struct super_block *sb = elixir_get_mount(drive)->sb;
+
+    sb->s_free_blocks = bb->free_count;
+    if (elixir_write_bitmap(drive, sb, bb) != 0)
+        return -1;
+    return elixir_write_super(drive, sb);
+}
+
+uint32_t alloc_extent(uint8_t drive, uint32_t nblocks, uint32_t hint) {
+    struct block_bitmap *bb = alloc_bitmap(drive);
+    if (!bb || nblocks == 0) return UINT32_MAX;
+
+    if (bb->runs[1].best < nblocks) return UINT32_MAX;
+    if (hint >= bb->total) hint = 0;
+
+    struct run_search s = { nblocks, hint, 0 };
+    uint32_t start = run_find(bb, &s, 1, 0, 32 * bb->leaves);
+    if (start == UINT32_MAX && hint) {
+        s = (struct run_search){ nblocks, 0, 0 };
+        start = run_find(bb, &s, 1, 0, 32 * bb->leaves);
+    }
+    if (start == UINT32_MAX) return UINT32_MAX;
+
+    bitmap_set_range(bb, start, nblocks, 1);
+    if (bitmap_store(drive, bb) != 0) {
+        // bitmap_store already took the lower count into the superblock
+        bitmap_set_range(bb, start, nblocks, 0);
+        elixir_get_mount(drive)->sb->s_free_blocks = bb->free_count;
+        printf("Error: failed to record extent %u+%u on drive %u\n", start, nblocks, (unsigned)drive);
+        return UINT32_MAX;
+    }
+    return start;
+}
+
+// Longest run of free blocks on the drive
+uint32_t alloc_max_run(uint8_t drive) {
+    struct block_bitmap *bb = alloc_bitmap(drive);
+    return bb ? bb->runs[1].best : 0;
+}
+
+int free_extent(uint8_t drive, uint32_t start, uint32_t nblocks) {
+    struct block_bitmap *bb = alloc_bitmap(drive);
+    if (!bb || nblocks == 0) return -1;
+
+    if (start >= bb->total || nblocks > bb->total - start) return -1;
+
+    for (uint32_t bit = start; bit < start + nblocks; bit++) {
+        if (!(bb->bitmap[bit / 8] & (1u << (bit % 8)))) {
+            printf("Error: freeing free block %u on drive %u\n", bit, (unsigned)drive);
+            return -1;
+        }
+    }
+
+    bitmap_set_range(bb, start, nblocks, 0);
+    return bitmap_store(drive, bb);
+}
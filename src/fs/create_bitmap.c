@@ -1,100 +1,128 @@
 #include <stdbool.h>
 #include <fs/elixir.h>
 #include <mem.h>
-#include <ide.h>
+#include <blk.h>
+#include <bcache.h>
+#include <bitops.h>
 #include <vga.h>
 
-struct block_bitmap *create_bitmap(uint8_t drive) {
-    extern struct ide_device ide_devices[4];
-
-    if (drive >= 4) {
-        printf("Invalid drive index: %u\n", (unsigned)drive);
-        return NULL;
-    }
-
-    uint32_t size = ide_devices[drive].Size;
+struct block_bitmap *create_bitmap(struct arena *arena, struct super_block *sb) {
+    uint32_t size = sb->s_total_blocks;
     if (size == 0) {
-        printf("Drive %u reports zero size\n", (unsigned)drive);
+        printf("Filesystem has zero blocks\n");
         return NULL;
     }
 
-    struct block_bitmap *bb = kmalloc(sizeof(struct block_bitmap));
+    struct block_bitmap *bb = arena_alloc(arena, sizeof(struct block_bitmap));
     if (!bb) {
         printf("Failed to allocate block_bitmap\n");
         return NULL;
     }
 
+    // Whole sectors, since elixir_write_bitmap writes the buffer out sector by sector
     uint32_t bitmap_bytes = (size + 7) / 8;
-    bb->bitmap = kmalloc(bitmap_bytes);
-    if (!bb->bitmap) {
+    uint32_t bitmap_sectors = elixir_bitmap_sectors(size);
+    bb->bitmap = arena_zalloc(arena, bitmap_sectors * 512);
+    bb->dirty = arena_zalloc(arena, (bitmap_sectors + 31) / 32 * 4);
+    if (!bb->bitmap || !bb->dirty) {
         printf("Failed to allocate bitmap data\n");
-        kfree(bb);
         return NULL;
     }
 
-    memset(bb->bitmap, 0, bitmap_bytes);
-
     bb->total = size;
     bb->free_count = size;
     bb->used_count = 0;
 
-    printf("Bitmap created: %u sectors, %u bytes\n", size, bitmap_bytes);
+    // The blocks holding the superblock, bitmap and inode table are never handed out
+    uint32_t spb = elixir_sectors_per_block(sb);
+    uint32_t reserved = (sb->s_data_start_lba + spb - 1) / spb;
+    if (reserved > size) reserved = size;
+    for (uint32_t block = 0; block < reserved; block++)
+        bb->bitmap[block / 8] |= (uint8_t)(1u << (block % 8));
+    bb->free_count -= reserved;
+    bb->used_count += reserved;
+    sb->s_free_blocks = bb->free_count;
+
+    // Nothing is on disk yet
+    elixir_bitmap_dirty(bb, 0, size);
+
+    printf("Bitmap created: %u blocks, %u bytes\n", size, bitmap_bytes);
 
     return bb;
 }
 
-int elixir_write_bitmap(uint8_t drive, struct block_bitmap *bb) {
-    if (!bb || !bb->bitmap) return -1;
+static int bitmap_sector_dirty(const struct block_bitmap *bb, uint32_t sector) {
+    return (bb->dirty[sector / 32] >> (sector % 32)) & 1;
+}
 
-    uint32_t bitmap_bytes = (bb->total + 7) / 8;
-    uint32_t bitmap_sectors = (bitmap_bytes + 511) / 512;
+// Mark the bitmap sectors holding bits [start, start + n)
+void elixir_bitmap_dirty(struct block_bitmap *bb, uint32_t start, uint32_t n) {
+    if (n == 0) return;
 
-    if (ide_write_sectors_counted(drive, ELIXIR_BITMAP_START_LBA, bitmap_sectors * 512, bb->bitmap) != 0) {
-        printf("Error: failed to write bitmap\n");
-        return -1;
+    for (uint32_t sector = start / 4096; sector <= (start + n - 1) / 4096; sector++)
+        bb->dirty[sector / 32] |= 1u << (sector % 32);
+}
+
+int elixir_write_bitmap(uint8_t drive, const struct super_block *sb, struct block_bitmap *bb) {
+    if (!bb || !bb->bitmap || !bb->dirty) return -1;
+
+    uint32_t bitmap_sectors = elixir_bitmap_sectors(bb->total);
+    uint32_t sector = 0;
+
+    while (sector < bitmap_sectors) {
+        // Skip clean words whole
+        if (sector % 32 == 0 && !bb->dirty[sector / 32]) {
+            sector += 32;
+            continue;
+        }
+        if (!bitmap_sector_dirty(bb, sector)) {
+            sector++;
+            continue;
+        }
+
+        uint32_t end = sector + 1;
+        while (end < bitmap_sectors && bitmap_sector_dirty(bb, end))
+            end++;
+
+        if (bcache_write(drive, sb->s_bitmap_start_lba + sector, end - sector,
+                         bb->bitmap + sector * 512) != 0) {
+            printf("Error: failed to write bitmap sectors %u-%u\n", sector, end - 1);
+            return -1;
+        }
+        for (; sector < end; sector++)
+            bb->dirty[sector / 32] &= ~(1u << (sector % 32));
     }
 
     return 0;
 }
 
-int elixir_read_bitmap(uint8_t drive, struct block_bitmap **bb_out) {
-    extern struct ide_device ide_devices[4];
+int elixir_read_bitmap(struct arena *arena, uint8_t drive, const struct super_block *sb,
+                       struct block_bitmap **bb_out) {
+    if (drive >= BLK_MAX_DRIVES) return -1;
 
-    if (drive >= 4) return -1;
+    uint32_t size = sb->s_total_blocks;
+    uint32_t bitmap_sectors = elixir_bitmap_sectors(size);
 
-    uint32_t size = ide_devices[drive].Size;
-    uint32_t bitmap_bytes = (size + 7) / 8;
-    uint32_t bitmap_sectors = (bitmap_bytes + 511) / 512;
-
-    struct block_bitmap *bb = kmalloc(sizeof(struct block_bitmap));
+    struct block_bitmap *bb = arena_zalloc(arena, sizeof(struct block_bitmap));
     if (!bb) return -1;
 
-    bb->bitmap = kmalloc(bitmap_sectors * 512);
-    if (!bb->bitmap) {
-        kfree(bb);
-        return -1;
-    }
+    bb->bitmap = arena_alloc(arena, bitmap_sectors * 512);
+    bb->dirty = arena_zalloc(arena, (bitmap_sectors + 31) / 32 * 4);
+    if (!bb->bitmap || !bb->dirty) return -1;
 
-    if (ide_read_sectors(drive, bitmap_sectors, ELIXIR_BITMAP_START_LBA, bb->bitmap) != 0) {
-        kfree(bb->bitmap);
-        kfree(bb);
+    if (bcache_read(drive, sb->s_bitmap_start_lba, bitmap_sectors, bb->bitmap) != 0)
         return -1;
-    }
 
-    bb->total = size;
-    bb->free_count = 0;
-    bb->used_count = 0;
+    // Bits past the last block are never set, so whole words can be counted
+    const uint64_t *words = (const uint64_t *)bb->bitmap;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < bitmap_sectors * 512 / 8; i++)
+        used += popcount64(words[i]);
 
-    for (uint32_t i = 0; i < size; i++) {
-        uint32_t byte_idx = i / 8;
-        uint32_t bit_idx = i % 8;
-        if (bb->bitmap[byte_idx] & (1 << bit_idx)) {
-            bb->used_count++;
-        } else {
-            bb->free_count++;
-        }
-    }
+    bb->total = size;
+    bb->used_count = used;
+    bb->free_count = size - used;
 
     *bb_out = bb;
     return 0;
-}
\ No newline at end of file
+}
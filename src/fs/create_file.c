@@ -1,28 +1,27 @@
 #include <fs/elixir.h>
 #include <vga.h>
-#include <ide.h>
+#include <blk.h>
 #include <mem.h>
 
-struct index* create_file(uint8_t drive) {
+struct index* create_file(struct arena *arena, uint8_t drive) {
     struct index* in;
 
-    if (drive >= 4) {
+    if (drive >= BLK_MAX_DRIVES) {
         printf("Error: Invalid drive index %d.\n", drive);
         return NULL;
     }
 
     printf("Allocating index struct...\n");
-    in = kmalloc(sizeof(struct index));
+    in = arena_zalloc(arena, sizeof(struct index));
     if (!in)  {
         printf("Failed to allocate index!\n");
         return NULL;
     }
 
-    memset(in, 0, sizeof(struct index));
-
-    in->type = 1;
+    in->type = ELIXIR_TYPE_FILE;
     in->size = 0;
-    in->first_block = 0;
+    in->blocks = 0;
+    in->depth = 0;
     in->time_stamp = 0;
 
     return in;
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <fs/dcache.h>
+#include <mem.h>
+
+static struct dentry dentries[DCACHE_ENTRIES];
+static struct dentry *hash[DCACHE_HASH_SIZE];
+static struct dentry lru = { .lru_prev = &lru, .lru_next = &lru };     // Most recent first
+static uint32_t dentries_used;
+static struct dcache_stats stats;
+
+static uint32_t dcache_hash(uint8_t drive, uint32_t parent, uint32_t name_hash) {
+    return (name_hash ^ (parent * 2654435761u) ^ drive) & (DCACHE_HASH_SIZE - 1);
+}
+
+static struct dentry *dcache_find(uint8_t drive, uint32_t parent, uint32_t name_hash,
+                                  const char *name, uint32_t len) {
+    struct dentry *d = hash[dcache_hash(drive, parent, name_hash)];
+    while (d && (d->drive != drive || d->parent != parent || d->hash != name_hash ||
+                 d->len != len || memcmp(d->name, name, len) != 0))
+        d = d->hash_next;
+    return d;
+}
+
+static void lru_unlink(struct dentry *d) {
+    d->lru_prev->lru_next = d->lru_next;
+    d->lru_next->lru_prev = d->lru_prev;
+}
+
+static void lru_insert(struct dentry *after, struct dentry *d) {
+    d->lru_prev = after;
+    d->lru_next = after->lru_next;
+    after->lru_next->lru_prev = d;
+    after->lru_next = d;
+}
+
+// Unhash an entry and send it to the tail, where it is reused first
+static void dcache_drop(struct dentry *d) {
+    struct dentry **link = &hash[dcache_hash(d->drive, d->parent, d->hash)];
+    while (*link && *link != d)
+        link = &(*link)->hash_next;
+    if (*link) *link = d->hash_next;
+
+    d->len = 0;
+    stats.entries--;
+    lru_unlink(d);
+    lru_insert(lru.lru_prev, d);
+}
+
+uint32_t dcache_lookup(uint8_t drive, uint32_t parent, uint32_t name_hash, const char *name, uint32_t len) {
+    struct dentry *d = dcache_find(drive, parent, name_hash, name, len);
+    if (!d) {
+        stats.misses++;
+        return UINT32_MAX;
+    }
+
+    stats.hits++;
+    lru_unlink(d);
+    lru_insert(&lru, d);
+    return d->ino;
+}
+
+void dcache_add(uint8_t drive, uint32_t parent, uint32_t name_hash, const char *name, uint32_t len,
+                uint32_t ino) {
+    if (len == 0 || len > ELIXIR_NAME_MAX) return;
+
+    struct dentry *d = dcache_find(drive, parent, name_hash, name, len);
+    if (d) {
+        d->ino = ino;
+        lru_unlink(d);
+        lru_insert(&lru, d);
+        return;
+    }
+
+    if (dentries_used < DCACHE_ENTRIES) {
+        d = &dentries[dentries_used++];
+    } else {
+        d = lru.lru_prev;
+        if (d->len) {
+            dcache_drop(d);
+            stats.evictions++;
+        }
+        lru_unlink(d);
+    }
+
+    d->drive = drive;
+    d->len = (uint8_t)len;
+    d->parent = parent;
+    d->hash = name_hash;
+    d->ino = ino;
+    memcpy(d->name, name, len);
+
+    uint32_t h = dcache_hash(drive, parent, name_hash);
+    d->hash_next = hash[h];
+    hash[h] = d;
+    lru_insert(&lru, d);
+    stats.entries++;
+}
+
+void dcache_remove(uint8_t drive, uint32_t parent, uint32_t name_hash, const char *name, uint32_t len) {
+    struct dentry *d = dcache_find(drive, parent, name_hash, name, len);
+    if (d) dcache_drop(d);
+}
+
+// Forget every entry of a drive, as on unmount
+void dcache_invalidate(uint8_t drive) {
+    for (uint32_t i = 0; i < dentries_used; i++) {
+        if (dentries[i].len && dentries[i].drive == drive)
+            dcache_drop(&dentries[i]);
+    }
+}
+
+void dcache_get_stats(struct dcache_stats *out) {
+    *out = stats;
+}
@@ -0,0 +1,255 @@
+#include <stdint.h>
+#include <fs/elixir.h>
+#include <fs/dcache.h>
+#include <blk.h>
+#include <mem.h>
+#include <vga.h>
+
+static struct elixir_dir_stats stats;
+
+// FNV-1a
+uint32_t elixir_name_hash(const char *name, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int name_valid(const char *name, uint32_t len) {
+    if (len == 0 || len > ELIXIR_NAME_MAX) return 0;
+    for (uint32_t i = 0; i < len; i++)
+        if (name[i] == '/' || name[i] == '\0') return 0;
+    return 1;
+}
+
+/* ============================================================================
+ * BUCKETS
+ * ============================================================================ */
+
+static int bucket_read(uint8_t drive, const struct index *dir, uint32_t b, struct dir_bucket *bk) {
+    stats.buckets_read++;
+    return elixir_file_read(drive, dir, (b + 1) * BLK_SECTOR_SIZE, bk, sizeof(*bk)) == sizeof(*bk) ? 0 : -1;
+}
+
+static int bucket_write(uint8_t drive, struct index *dir, uint32_t b, const struct dir_bucket *bk) {
+    return elixir_file_write(drive, dir, (b + 1) * BLK_SECTOR_SIZE, bk, sizeof(*bk)) == sizeof(*bk) ? 0 : -1;
+}
+
+static int header_write(uint8_t drive, struct index *dir, const struct dir_header *hdr) {
+    return elixir_file_write(drive, dir, 0, hdr, sizeof(*hdr)) == sizeof(*hdr) ? 0 : -1;
+}
+
+// Read a directory's index and header. An empty directory has no table yet
+// and reads back with zero buckets.
+static int dir_open(uint8_t drive, uint32_t ino, struct index *dir, struct dir_header *hdr) {
+    if (elixir_read_index(drive, ino, dir) != 0) return -1;
+    if (dir->type != ELIXIR_TYPE_DIR) {
+        printf("Error: index %u on drive %u is not a directory\n", ino, (unsigned)drive);
+        return -1;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    if (dir->size == 0) return 0;
+
+    if (elixir_file_read(drive, dir, 0, hdr, sizeof(*hdr)) != sizeof(*hdr) ||
+        hdr->magic != ELIXIR_DIR_MAGIC || !hdr->buckets || (hdr->buckets & (hdr->buckets - 1))) {
+        printf("Error: bad directory %u on drive %u\n", ino, (unsigned)drive);
+        return -1;
+    }
+    return 0;
+}
+
+// Find a name, leaving its bucket in bk. Probing stops at the first bucket
+// that never overflowed.
+static int dir_find(uint8_t drive, const struct index *dir, const struct dir_header *hdr,
+                    uint32_t hash, const char *name, uint32_t len,
+                    struct dir_bucket *bk, uint32_t *b_out, uint32_t *slot_out) {
+    for (uint32_t i = 0; i < hdr->buckets; i++) {
+        uint32_t b = (hash + i) & (hdr->buckets - 1);
+        if (bucket_read(drive, dir, b, bk) != 0) return -1;
+
+        for (uint32_t slot = 0; slot < ELIXIR_BUCKET_ENTRIES; slot++) {
+            const struct dir_entry *e = &bk->entries[slot];
+            if (e->len == len && e->hash == hash && memcmp(e->name, name, len) == 0) {
+                *b_out = b;
+                *slot_out = slot;
+                return 0;
+            }
+        }
+        if (!(bk->flags & ELIXIR_BUCKET_OVERFLOWED)) return -1;
+    }
+    return -1;
+}
+
+static int dir_insert(uint8_t drive, struct index *dir, struct dir_header *hdr, const struct dir_entry *e) {
+    struct dir_bucket bk;
+
+    for (uint32_t i = 0; i < hdr->buckets; i++) {
+        uint32_t b = (e->hash + i) & (hdr->buckets - 1);
+        if (bucket_read(drive, dir, b, &bk) != 0) return -1;
+
+        if (bk.count < ELIXIR_BUCKET_ENTRIES) {
+            uint32_t slot = 0;
+            while (bk.entries[slot].len) slot++;
+            bk.entries[slot] = *e;
+            bk.count++;
+            hdr->entries++;
+            return bucket_write(drive, dir, b, &bk);
+        }
+        if (!(bk.flags & ELIXIR_BUCKET_OVERFLOWED)) {
+            bk.flags |= ELIXIR_BUCKET_OVERFLOWED;
+            if (bucket_write(drive, dir, b, &bk) != 0) return -1;
+        }
+    }
+    return -1;
+}
+
+/* ============================================================================
+ * GROWTH
+ * ============================================================================ */
+
+// Rehash into a table twice the size. Old bucket b feeds new buckets b and
+// b + old size, so both tables are walked in order and the cache sees
+// three sequential streams. The old table is freed once the directory's
+// index points at the new one.
+static int dir_grow(uint8_t drive, uint32_t ino, struct index *dir, struct dir_header *hdr) {
+    struct dir_header grown = {
+        .magic = ELIXIR_DIR_MAGIC,
+        .buckets = hdr->buckets ? hdr->buckets * 2 : ELIXIR_DIR_MIN_BUCKETS,
+    };
+    struct index fresh, old;
+    struct dir_bucket bk;
+
+    memset(&fresh, 0, sizeof(fresh));
+    fresh.type = ELIXIR_TYPE_DIR;
+    fresh.time_stamp = dir->time_stamp;
+
+    if (elixir_file_truncate(drive, &fresh, (grown.buckets + 1) * BLK_SECTOR_SIZE) != 0)
+        goto fail;
+
+    for (uint32_t b = 0; b < hdr->buckets; b++) {
+        if (bucket_read(drive, dir, b, &bk) != 0) goto fail;
+        for (uint32_t slot = 0; slot < ELIXIR_BUCKET_ENTRIES; slot++) {
+            if (bk.entries[slot].len && dir_insert(drive, &fresh, &grown, &bk.entries[slot]) != 0)
+                goto fail;
+        }
+    }
+
+    if (header_write(drive, &fresh, &grown) != 0 || elixir_write_index(drive, ino, &fresh) != 0)
+        goto fail;
+
+    old = *dir;
+    *dir = fresh;
+    *hdr = grown;
+    elixir_file_truncate(drive, &old, 0);
+    stats.grows++;
+    return 0;
+
+fail:
+    printf("Error: cannot grow directory %u on drive %u\n", ino, (unsigned)drive);
+    elixir_file_truncate(drive, &fresh, 0);
+    return -1;
+}
+
+/* ============================================================================
+ * NAMES
+ * ============================================================================ */
+
+uint32_t elixir_lookup(uint8_t drive, uint32_t dir_ino, const char *name, uint32_t len) {
+    if (!name_valid(name, len)) return UINT32_MAX;
+
+    uint32_t hash = elixir_name_hash(name, len);
+    uint32_t ino = dcache_lookup(drive, dir_ino, hash, name, len);
+    if (ino != UINT32_MAX) return ino;
+
+    struct index dir;
+    struct dir_header hdr;
+    struct dir_bucket bk;
+    uint32_t b, slot;
+
+    stats.lookups++;
+    if (dir_open(drive, dir_ino, &dir, &hdr) != 0 || !hdr.buckets ||
+        dir_find(drive, &dir, &hdr, hash, name, len, &bk, &b, &slot) != 0)
+        return UINT32_MAX;
+
+    ino = bk.entries[slot].ino;
+    dcache_add(drive, dir_ino, hash, name, len, ino);
+    return ino;
+}
+
+int elixir_link(uint8_t drive, uint32_t dir_ino, const char *name, uint32_t len, uint32_t ino, uint8_t type) {
+    if (!name_valid(name, len)) return -1;
+
+    uint32_t hash = elixir_name_hash(name, len);
+    struct index dir;
+    struct dir_header hdr;
+    struct dir_bucket bk;
+    uint32_t b, slot;
+
+    if (dir_open(drive, dir_ino, &dir, &hdr) != 0) return -1;
+    if (hdr.buckets && dir_find(drive, &dir, &hdr, hash, name, len, &bk, &b, &slot) == 0) {
+        printf("Error: name already in directory %u on drive %u\n", dir_ino, (unsigned)drive);
+        return -1;
+    }
+
+    if ((hdr.entries + 1) * 4 > hdr.buckets * ELIXIR_BUCKET_ENTRIES * 3 &&
+        dir_grow(drive, dir_ino, &dir, &hdr) != 0)
+        return -1;
+
+    struct dir_entry e = { .hash = hash, .ino = ino, .type = type, .len = (uint8_t)len };
+    memcpy(e.name, name, len);
+    if (dir_insert(drive, &dir, &hdr, &e) != 0 || header_write(drive, &dir, &hdr) != 0) {
+        printf("Error: cannot add name to directory %u on drive %u\n", dir_ino, (unsigned)drive);
+        return -1;
+    }
+
+    dcache_add(drive, dir_ino, hash, name, len, ino);
+    return 0;
+}
+
+int elixir_unlink(uint8_t drive, uint32_t dir_ino, const char *name, uint32_t len) {
+    if (!name_valid(name, len)) return -1;
+
+    uint32_t hash = elixir_name_hash(name, len);
+    struct index dir;
+    struct dir_header hdr;
+    struct dir_bucket bk;
+    uint32_t b, slot;
+
+    dcache_remove(drive, dir_ino, hash, name, len);
+    if (dir_open(drive, dir_ino, &dir, &hdr) != 0 || !hdr.buckets ||
+        dir_find(drive, &dir, &hdr, hash, name, len, &bk, &b, &slot) != 0)
+        return -1;
+
+    // The overflowed flag stays, so names probed past this bucket are still found
+    memset(&bk.entries[slot], 0, sizeof(bk.entries[slot]));
+    bk.count--;
+    hdr.entries--;
+    if (bucket_write(drive, &dir, b, &bk) != 0 || header_write(drive, &dir, &hdr) != 0)
+        return -1;
+    return 0;
+}
+
+// Resolve an absolute path, one directory lookup per component
+uint32_t elixir_namei(uint8_t drive, const char *path) {
+    uint32_t ino = ELIXIR_ROOT_INO;
+
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+
+        uint32_t len = 0;
+        while (path[len] && path[len] != '/') len++;
+
+        ino = elixir_lookup(drive, ino, path, len);
+        if (ino == UINT32_MAX) return UINT32_MAX;
+        path += len;
+    }
+    return ino;
+}
+
+void elixir_dir_get_stats(struct elixir_dir_stats *out) {
+    *out = stats;
+}
@@ -1,79 +1,175 @@
 #include <stdint.h>
-#include <mem.h>
-#include <ide.h>
+#include <arena.h>
+#include <blk.h>
+#include <bcache.h>
 #include <fs/elixir.h>
+#include <fs/dcache.h>
 #include <vga.h>
 
+static struct elixir_mount mounts[BLK_MAX_DRIVES];
+
+struct elixir_mount *elixir_get_mount(uint8_t drive) {
+    if (drive >= BLK_MAX_DRIVES || !mounts[drive].sb) return NULL;
+    return &mounts[drive];
+}
+
+int elixir_write_super(uint8_t drive, const struct super_block *sb) {
+    return bcache_write(drive, ELIXIR_SUPERBLOCK_LBA, sizeof(struct super_block) / BLK_SECTOR_SIZE, sb);
+}
+
 int elixir_format(uint8_t drive) {
-    struct super_block *sb = create_super(drive);
-    if (!sb) {
-        printf("Error: create_super failed\n");
+    // The mount, its pinned superblock and the dentry cache would all go stale
+    if (elixir_get_mount(drive)) {
+        printf("Error: drive %u is mounted; unmount it before formatting\n", (unsigned)drive);
         return -1;
     }
 
-    size_t sb_bytes = sizeof(struct super_block);
-    if (ide_write_sectors_counted(drive, ELIXIR_SUPERBLOCK_LBA, sb_bytes, (const void *)sb) != 0) {
-        printf("Error: failed to write superblock to drive %u\n", (unsigned)drive);
-        kfree(sb);
+    struct arena *scratch = arena_create(ARENA_DEFAULT_ORDER);
+    if (!scratch) {
+        printf("Error: no memory to format drive %u\n", (unsigned)drive);
         return -1;
     }
 
-    printf("Superblock written to LBA %u\n", ELIXIR_SUPERBLOCK_LBA);
+    int ret = -1;
+
+    struct super_block *sb = create_super(scratch, drive);
+    if (!sb) {
+        printf("Error: create_super failed\n");
+        goto out;
+    }
 
-    struct block_bitmap *bb = create_bitmap(drive);
+    // Fills in s_free_blocks, so it comes before the superblock write
+    struct block_bitmap *bb = create_bitmap(scratch, sb);
     if (!bb) {
         printf("Error: failed to create bitmap\n");
-        kfree(sb);
-        return -1;
+        goto out;
+    }
+
+    if (elixir_write_super(drive, sb) != 0) {
+        printf("Error: failed to write superblock to drive %u\n", (unsigned)drive);
+        goto out;
     }
 
-    if (elixir_write_bitmap(drive, bb) != 0) {
+    printf("Superblock written to LBA %u\n", ELIXIR_SUPERBLOCK_LBA);
+
+    if (elixir_write_bitmap(drive, sb, bb) != 0) {
         printf("Error: failed to write bitmap\n");
-        kfree(bb->bitmap);
-        kfree(bb);
-        kfree(sb);
-        return -1;
+        goto out;
     }
 
-    printf("Bitmap written to LBA %u\n", sb->s_bitmap_start_lba);
+    // A zeroed inode table, so no index reads back whatever the disk held,
+    // with an empty root directory whose hash table comes with the first name
+    struct index *table = arena_zalloc(scratch, sb->s_total_inodes * sizeof(struct index));
+    struct index *root = create_file(scratch, drive);
+    if (!table || !root) goto out;
+    root->type = ELIXIR_TYPE_DIR;
+    table[ELIXIR_ROOT_INO] = *root;
+    if (bcache_write(drive, sb->s_inode_table_lba, sb->s_total_inodes, table) != 0) {
+        printf("Error: failed to write the inode table\n");
+        goto out;
+    }
 
-    kfree(bb->bitmap);
-    kfree(bb);
-    kfree(sb);
+    // One writeback and barrier make the superblock and bitmap durable together
+    if (bcache_sync(drive) != 0) {
+        printf("Error: failed to flush drive %u\n", (unsigned)drive);
+        goto out;
+    }
 
+    printf("Bitmap written to LBA %u\n", sb->s_bitmap_start_lba);
     printf("Elixir filesystem formatted successfully on drive %u\n", (unsigned)drive);
-    return 0;
+    ret = 0;
+
+out:
+    arena_destroy(scratch);
+    return ret;
 }
 
-int elixir_mount(uint8_t drive, struct super_block **sb_out) {
-    if (drive >= 4) {
+// Reads only the superblock when it was unmounted cleanly; otherwise the
+// bitmap is recounted and the free count repaired before anything trusts it
+int elixir_mount(struct arena *arena, uint8_t drive, struct super_block **sb_out) {
+    if (drive >= BLK_MAX_DRIVES) {
         printf("Error: Invalid drive index %u\n", (unsigned)drive);
         return -1;
     }
 
-    struct super_block *sb = kmalloc(sizeof(struct super_block));
+    struct elixir_mount *m = &mounts[drive];
+    if (m->sb) {
+        printf("Error: drive %u is already mounted\n", (unsigned)drive);
+        return -1;
+    }
+
+    struct super_block *sb = arena_alloc(arena, sizeof(struct super_block));
     if (!sb) {
         printf("Error: failed to allocate superblock\n");
         return -1;
     }
 
-    if (ide_read_sectors(drive, 1, ELIXIR_SUPERBLOCK_LBA, sb) != 0) {
+    if (bcache_read(drive, ELIXIR_SUPERBLOCK_LBA, 1, sb) != 0) {
         printf("Error: failed to read superblock from drive %u\n", (unsigned)drive);
-        kfree(sb);
         return -1;
     }
 
     if (sb->s_magic != ELIXIR_MAGIC) {
         printf("Error: invalid magic number 0x%X (expected 0x%X)\n", sb->s_magic, ELIXIR_MAGIC);
-        kfree(sb);
         return -1;
     }
 
+    // Older formats stored 128-sector blocks as 65536, which wraps to 0
+    if (elixir_sectors_per_block(sb) == 0) {
+        printf("Error: bad block size %u on drive %u\n", sb->s_block_size, (unsigned)drive);
+        return -1;
+    }
+
+    m->arena = arena;
+    m->bb = NULL;
+
+    if (sb->s_state != ELIXIR_STATE_CLEAN) {
+        printf("Elixir: drive %u was not unmounted cleanly, recounting free blocks\n", (unsigned)drive);
+        if (elixir_read_bitmap(arena, drive, sb, &m->bb) != 0) {
+            printf("Error: failed to read the block bitmap of drive %u\n", (unsigned)drive);
+            return -1;
+        }
+        sb->s_free_blocks = m->bb->free_count;
+    }
+
+    // Mark the filesystem in use before anything else reaches the disk
+    sb->s_state = ELIXIR_STATE_DIRTY;
+    if (elixir_write_super(drive, sb) != 0 || bcache_sync(drive) != 0) {
+        printf("Error: failed to mark drive %u in use\n", (unsigned)drive);
+        return -1;
+    }
+
+    // The superblock is rewritten on every allocation; keep it resident
+    if (bcache_pin(drive, ELIXIR_SUPERBLOCK_LBA, 1) != 0)
+        printf("Note: Elixir superblock on drive %u is not pinned in the cache\n", (unsigned)drive);
+
+    m->sb = sb;
+
     printf("Elixir filesystem mounted on drive %u\n", (unsigned)drive);
     printf("  Block size: %u bytes\n", sb->s_block_size);
     printf("  Total blocks: %u\n", sb->s_total_blocks);
     printf("  Free blocks: %u\n", sb->s_free_blocks);
 
-    *sb_out = sb;
+    if (sb_out) *sb_out = sb;
+    return 0;
+}
+
+// Write everything back and mark the superblock clean. The caller's arena
+// still owns the in-memory structures.
+int elixir_unmount(uint8_t drive) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m) return -1;
+
+    m->sb->s_state = ELIXIR_STATE_CLEAN;
+    if (elixir_write_super(drive, m->sb) != 0 || bcache_sync(drive) != 0) {
+        printf("Error: failed to unmount drive %u cleanly\n", (unsigned)drive);
+        m->sb->s_state = ELIXIR_STATE_DIRTY;
+        return -1;
+    }
+
+    bcache_unpin(drive, ELIXIR_SUPERBLOCK_LBA, 1);
+    dcache_invalidate(drive);
+    m->sb = NULL;
+    m->bb = NULL;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <fs/elixir.h>
+#include <bcache.h>
+#include <blk.h>
+#include <mem.h>
+#include <vga.h>
+
+static uint32_t extent_block_capacity(const struct super_block *sb) {
+    uint32_t bytes = sb->s_block_size < BCACHE_BLOCK_SIZE ? sb->s_block_size : BCACHE_BLOCK_SIZE;
+    return (bytes - sizeof(struct extent_block)) / sizeof(struct elixir_extent);
+}
+
+// The cache buffer holding an extent block, referenced until bcache_put
+static struct extent_block *eb_get(uint8_t drive, const struct super_block *sb, uint32_t block,
+                                   struct buffer_head **bh_out) {
+    uint32_t lba = block * elixir_sectors_per_block(sb);
+    struct buffer_head *bh = bcache_get(drive, lba / BCACHE_BLOCK_SECTORS);
+    if (!bh) return NULL;
+
+    *bh_out = bh;
+    return (struct extent_block *)(bh->data + lba % BCACHE_BLOCK_SECTORS * BLK_SECTOR_SIZE);
+}
+
+static struct extent_block *eb_load(uint8_t drive, const struct super_block *sb, uint32_t block,
+                                    struct buffer_head **bh_out) {
+    struct extent_block *eb = eb_get(drive, sb, block, bh_out);
+    if (eb && (eb->magic != ELIXIR_EXTENT_MAGIC || eb->count > extent_block_capacity(sb))) {
+        printf("Error: bad extent block %u on drive %u\n", block, (unsigned)drive);
+        bcache_put(*bh_out);
+        return NULL;
+    }
+    return eb;
+}
+
+// Last of n extents sorted by file_block that starts at or before
+// file_block, or -1
+static int extent_search(const struct elixir_extent *ext, uint32_t n, uint32_t file_block) {
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (ext[mid].file_block <= file_block) lo = mid + 1;
+        else hi = mid;
+    }
+    return (int)lo - 1;
+}
+
+/* ============================================================================
+ * LOOKUP
+ * ============================================================================ */
+
+uint32_t elixir_bmap(uint8_t drive, const struct index *in, uint32_t file_block, uint32_t *run) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m || file_block >= in->blocks) return UINT32_MAX;
+
+    const struct elixir_extent *ext = in->extents;
+    uint32_t n = in->extent_count;
+    struct buffer_head *bh = NULL;
+
+    if (in->depth) {
+        int i = extent_search(ext, n, file_block);
+        if (i < 0) return UINT32_MAX;
+
+        struct extent_block *eb = eb_load(drive, m->sb, ext[i].start, &bh);
+        if (!eb) return UINT32_MAX;
+        ext = eb->extents;
+        n = eb->count;
+    }
+
+    uint32_t block = UINT32_MAX;
+    int i = extent_search(ext, n, file_block);
+    if (i >= 0 && file_block - ext[i].file_block < ext[i].count) {
+        uint32_t into = file_block - ext[i].file_block;
+        block = ext[i].start + into;
+        if (run) *run = ext[i].count - into;
+    }
+
+    bcache_put(bh);
+    return block;
+}
+
+/* ============================================================================
+ * GROWTH
+ * ============================================================================ */
+
+// Move the inline extents into an extent block and take the file to depth 1
+static int extent_spill(uint8_t drive, const struct super_block *sb, struct index *in) {
+    struct buffer_head *bh;
+    uint32_t block = alloc_extent(drive, 1, 0);
+    if (block == UINT32_MAX) return -1;
+
+    struct extent_block *eb = eb_get(drive, sb, block, &bh);
+    if (!eb) {
+        free_extent(drive, block, 1);
+        return -1;
+    }
+
+    eb->magic = ELIXIR_EXTENT_MAGIC;
+    eb->count = in->extent_count;
+    eb->reserved = 0;
+    memcpy(eb->extents, in->extents, in->extent_count * sizeof(struct elixir_extent));
+    bcache_mark_dirty(bh);
+    bcache_put(bh);
+
+    memset(in->extents, 0, sizeof(in->extents));
+    in->extents[0] = (struct elixir_extent){ 0, block, 1 };
+    in->extent_count = 1;
+    in->depth = 1;
+    return 0;
+}
+
+// Map count blocks from start after the end of the file, merging with the
+// last extent when they follow it on disk
+static int extent_append(uint8_t drive, const struct super_block *sb, struct index *in,
+                         uint32_t start, uint32_t count) {
+    struct elixir_extent ext = { in->blocks, start, count };
+    struct elixir_extent *last;
+    struct buffer_head *bh;
+
+    if (in->depth == 0) {
+        last = in->extent_count ? &in->extents[in->extent_count - 1] : NULL;
+        if (last && last->start + last->count == start) {
+            last->count += count;
+            in->blocks += count;
+            return 0;
+        }
+        if (in->extent_count < ELIXIR_INLINE_EXTENTS) {
+            in->extents[in->extent_count++] = ext;
+            in->blocks += count;
+            return 0;
+        }
+        if (extent_spill(drive, sb, in) != 0) return -1;
+    }
+
+    struct extent_block *eb = eb_load(drive, sb, in->extents[in->extent_count - 1].start, &bh);
+    if (!eb) return -1;
+
+    last = eb->count ? &eb->extents[eb->count - 1] : NULL;
+    if (last && last->start + last->count == start) {
+        last->count += count;
+    } else if (eb->count < extent_block_capacity(sb)) {
+        eb->extents[eb->count++] = ext;
+    } else {
+        bcache_put(bh);
+        if (in->extent_count == ELIXIR_INLINE_EXTENTS) {
+            printf("Error: extent tree full on drive %u\n", (unsigned)drive);
+            return -1;
+        }
+
+        uint32_t block = alloc_extent(drive, 1, 0);
+        if (block == UINT32_MAX) return -1;
+        if (!(eb = eb_get(drive, sb, block, &bh))) {
+            free_extent(drive, block, 1);
+            return -1;
+        }
+
+        eb->magic = ELIXIR_EXTENT_MAGIC;
+        eb->count = 1;
+        eb->reserved = 0;
+        eb->extents[0] = ext;
+        in->extents[in->extent_count++] = (struct elixir_extent){ in->blocks, block, 1 };
+    }
+
+    bcache_mark_dirty(bh);
+    bcache_put(bh);
+    in->blocks += count;
+    return 0;
+}
+
+int elixir_extend(uint8_t drive, struct index *in, uint32_t nblocks) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m || (in->flags & ELIXIR_INDEX_INLINE)) return -1;
+
+    uint32_t old = in->blocks;
+    uint32_t hint = 0;
+    if (in->blocks) {
+        uint32_t last = elixir_bmap(drive, in, in->blocks - 1, NULL);
+        if (last != UINT32_MAX) hint = last + 1;
+    }
+
+    while (nblocks) {
+        // The longest free run caps the request, so the loop takes the
+        // fewest extents the free space allows
+        uint32_t want = alloc_max_run(drive);
+        if (want > nblocks) want = nblocks;
+
+        uint32_t start = want ? alloc_extent(drive, want, hint) : UINT32_MAX;
+        if (start == UINT32_MAX) {
+            printf("Error: no space to extend file on drive %u\n", (unsigned)drive);
+            goto fail;
+        }
+        if (extent_append(drive, m->sb, in, start, want) != 0) {
+            free_extent(drive, start, want);
+            goto fail;
+        }
+
+        hint = start + want;
+        nblocks -= want;
+    }
+    return 0;
+
+fail:
+    elixir_shrink(drive, in, in->blocks - old);
+    return -1;
+}
+
+/* ============================================================================
+ * SHRINKING
+ * ============================================================================ */
+
+// Back to depth 0 once the extents fit in the index again
+static void extent_collapse(uint8_t drive, const struct super_block *sb, struct index *in) {
+    struct buffer_head *bh;
+
+    if (in->extent_count == 0) {
+        in->depth = 0;
+        return;
+    }
+    if (in->extent_count > 1) return;
+
+    uint32_t block = in->extents[0].start;
+    struct extent_block *eb = eb_load(drive, sb, block, &bh);
+    if (!eb) return;
+    if (eb->count > ELIXIR_INLINE_EXTENTS) {
+        bcache_put(bh);
+        return;
+    }
+
+    in->extent_count = eb->count;
+    memcpy(in->extents, eb->extents, eb->count * sizeof(struct elixir_extent));
+    bcache_put(bh);
+    free_extent(drive, block, 1);
+    in->depth = 0;
+}
+
+int elixir_shrink(uint8_t drive, struct index *in, uint32_t nblocks) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m || (in->flags & ELIXIR_INDEX_INLINE) || nblocks > in->blocks) return -1;
+
+    uint32_t keep = in->blocks - nblocks;
+    int ret = 0;
+
+    while (in->blocks > keep && in->extent_count) {
+        struct buffer_head *bh = NULL;
+        struct extent_block *eb = NULL;
+        struct elixir_extent *last;
+
+        if (in->depth) {
+            eb = eb_load(drive, m->sb, in->extents[in->extent_count - 1].start, &bh);
+            if (!eb) return -1;
+            if (!eb->count) {
+                bcache_put(bh);
+                return -1;
+            }
+            last = &eb->extents[eb->count - 1];
+        } else {
+            last = &in->extents[in->extent_count - 1];
+        }
+
+        uint32_t drop = in->blocks - keep < last->count ? in->blocks - keep : last->count;
+        if (free_extent(drive, last->start + last->count - drop, drop) != 0) ret = -1;
+        last->count -= drop;
+        in->blocks -= drop;
+
+        if (!eb) {
+            if (!last->count) in->extent_count--;
+            continue;
+        }
+
+        if (!last->count) eb->count--;
+        uint32_t left = eb->count;
+        bcache_mark_dirty(bh);
+        bcache_put(bh);
+        if (!left) {
+            in->extent_count--;
+            free_extent(drive, in->extents[in->extent_count].start, 1);
+        }
+    }
+
+    if (in->depth) extent_collapse(drive, m->sb, in);
+    memset(&in->extents[in->extent_count], 0,
+           (ELIXIR_INLINE_EXTENTS - in->extent_count) * sizeof(struct elixir_extent));
+    return ret;
+}
@@ -0,0 +1,214 @@
+#include <stdint.h>
+#include <fs/elixir.h>
+#include <bcache.h>
+#include <blk.h>
+#include <mem.h>
+#include <vga.h>
+
+/* ============================================================================
+ * INDEX TABLE
+ * ============================================================================ */
+
+static uint32_t index_lba(uint8_t drive, uint32_t ino) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m || ino >= m->sb->s_total_inodes) {
+        printf("Error: bad index %u on drive %u\n", ino, (unsigned)drive);
+        return UINT32_MAX;
+    }
+    return m->sb->s_inode_table_lba + ino;
+}
+
+int elixir_read_index(uint8_t drive, uint32_t ino, struct index *in) {
+    uint32_t lba = index_lba(drive, ino);
+    if (lba == UINT32_MAX) return -1;
+    return bcache_read(drive, lba, 1, in);
+}
+
+int elixir_write_index(uint8_t drive, uint32_t ino, const struct index *in) {
+    uint32_t lba = index_lba(drive, ino);
+    if (lba == UINT32_MAX) return -1;
+    return bcache_write(drive, lba, 1, in);
+}
+
+/* ============================================================================
+ * DATA
+ * ============================================================================ */
+
+static const uint8_t zeros[BCACHE_BLOCK_SIZE];
+
+// Move len bytes at offset between buf and the file's blocks, which must
+// already be mapped. Whole sectors inside one extent go as one cache
+// request; a partial sector is read, patched and written back. A write
+// with no buf writes zeros.
+static int file_io(uint8_t drive, const struct index *in, uint32_t offset,
+                   uint8_t *buf, uint32_t len, int write) {
+    const struct super_block *sb = elixir_get_mount(drive)->sb;
+    uint32_t bs = sb->s_block_size;
+    uint8_t sector[BLK_SECTOR_SIZE];
+
+    while (len) {
+        uint32_t run;
+        uint32_t block = elixir_bmap(drive, in, offset / bs, &run);
+        if (block == UINT32_MAX) return -1;
+
+        uint32_t lba = block * elixir_sectors_per_block(sb) + offset % bs / BLK_SECTOR_SIZE;
+        uint32_t skip = offset % BLK_SECTOR_SIZE;
+        uint32_t n;
+
+        if (skip || len < BLK_SECTOR_SIZE) {
+            n = BLK_SECTOR_SIZE - skip < len ? BLK_SECTOR_SIZE - skip : len;
+            if (bcache_read(drive, lba, 1, sector) != 0) return -1;
+            if (!write) {
+                memcpy(buf, sector + skip, n);
+            } else {
+                if (buf) memcpy(sector + skip, buf, n);
+                else memset(sector + skip, 0, n);
+                if (bcache_write(drive, lba, 1, sector) != 0) return -1;
+            }
+        } else {
+            // Bytes to the end of the extent, without overflowing on huge runs
+            uint32_t room = len + offset % bs;
+            if (run < room / bs + 1) room = run * bs;
+            n = (room - offset % bs < len ? room - offset % bs : len) & ~(BLK_SECTOR_SIZE - 1);
+            if (!buf && n > sizeof(zeros)) n = sizeof(zeros);
+
+            int ret = write ? bcache_write(drive, lba, n / BLK_SECTOR_SIZE, buf ? buf : zeros)
+                            : bcache_read(drive, lba, n / BLK_SECTOR_SIZE, buf);
+            if (ret != 0) return -1;
+        }
+
+        offset += n;
+        len -= n;
+        if (buf) buf += n;
+    }
+    return 0;
+}
+
+// Bytes read, short at the end of the file, or -1
+int elixir_file_read(uint8_t drive, const struct index *in, uint32_t offset, void *buf, uint32_t len) {
+    if (!elixir_get_mount(drive)) return -1;
+    if (offset >= in->size) return 0;
+    if (len > in->size - offset) len = in->size - offset;
+
+    if (in->flags & ELIXIR_INDEX_INLINE) {
+        memcpy(buf, in->data + offset, len);
+        return (int)len;
+    }
+
+    if (file_io(drive, in, offset, buf, len, 0) != 0) {
+        printf("Error: file read at %u failed on drive %u\n", offset, (unsigned)drive);
+        return -1;
+    }
+    return (int)len;
+}
+
+// Map enough blocks for size bytes
+static int file_map(uint8_t drive, struct index *in, uint32_t size) {
+    uint32_t bs = elixir_get_mount(drive)->sb->s_block_size;
+    uint32_t need = size / bs + (size % bs != 0);
+
+    if (need <= in->blocks) return 0;
+    return elixir_extend(drive, in, need - in->blocks);
+}
+
+/* ============================================================================
+ * INLINE DATA
+ * ============================================================================ */
+
+// Move an inline file's data out to blocks covering at least size bytes
+static int file_promote(uint8_t drive, struct index *in, uint32_t size) {
+    uint8_t data[ELIXIR_INLINE_DATA];
+    uint32_t len = in->size;
+
+    memcpy(data, in->data, len);
+    memset(in->data, 0, sizeof(in->data));
+    in->flags &= ~ELIXIR_INDEX_INLINE;
+
+    if (file_map(drive, in, size) == 0 && file_io(drive, in, 0, data, len, 1) == 0)
+        return 0;
+
+    elixir_shrink(drive, in, in->blocks);
+    memcpy(in->data, data, len);
+    in->flags |= ELIXIR_INDEX_INLINE;
+    return -1;
+}
+
+// Pull a file of at most ELIXIR_INLINE_DATA bytes back into its index and
+// free its blocks
+static int file_demote(uint8_t drive, struct index *in, uint32_t size) {
+    uint8_t data[ELIXIR_INLINE_DATA];
+
+    if (size && file_io(drive, in, 0, data, size, 0) != 0) return -1;
+    if (elixir_shrink(drive, in, in->blocks) != 0) return -1;
+
+    memset(in->data, 0, sizeof(in->data));
+    memcpy(in->data, data, size);
+    in->flags |= ELIXIR_INDEX_INLINE;
+    return 0;
+}
+
+int elixir_file_write(uint8_t drive, struct index *in, uint32_t offset, const void *buf, uint32_t len) {
+    if (!elixir_get_mount(drive) || offset + len < offset) return -1;
+    if (!len) return 0;
+
+    // A file with no blocks yet starts out inline when it fits
+    if (!in->blocks && offset + len <= ELIXIR_INLINE_DATA)
+        in->flags |= ELIXIR_INDEX_INLINE;
+
+    if (in->flags & ELIXIR_INDEX_INLINE) {
+        if (offset + len <= ELIXIR_INLINE_DATA) {
+            if (offset > in->size) memset(in->data + in->size, 0, offset - in->size);
+            memcpy(in->data + offset, buf, len);
+            if (offset + len > in->size) in->size = offset + len;
+            return (int)len;
+        }
+        if (file_promote(drive, in, offset + len) != 0) {
+            printf("Error: cannot move inline file to blocks on drive %u\n", (unsigned)drive);
+            return -1;
+        }
+    }
+
+    if (file_map(drive, in, offset + len) != 0 ||
+        (offset > in->size && file_io(drive, in, in->size, NULL, offset - in->size, 1) != 0) ||
+        file_io(drive, in, offset, (uint8_t *)buf, len, 1) != 0) {
+        printf("Error: file write at %u failed on drive %u\n", offset, (unsigned)drive);
+        return -1;
+    }
+
+    if (offset + len > in->size) in->size = offset + len;
+    return (int)len;
+}
+
+int elixir_file_truncate(uint8_t drive, struct index *in, uint32_t size) {
+    struct elixir_mount *m = elixir_get_mount(drive);
+    if (!m) return -1;
+
+    if (!in->blocks && size <= ELIXIR_INLINE_DATA)
+        in->flags |= ELIXIR_INDEX_INLINE;
+
+    if (in->flags & ELIXIR_INDEX_INLINE) {
+        if (size <= ELIXIR_INLINE_DATA) {
+            if (size > in->size) memset(in->data + in->size, 0, size - in->size);
+            else memset(in->data + size, 0, in->size - size);
+            in->size = size;
+            return 0;
+        }
+        if (file_promote(drive, in, size) != 0) return -1;
+    }
+
+    if (size > in->size) {
+        if (file_map(drive, in, size) != 0 ||
+            file_io(drive, in, in->size, NULL, size - in->size, 1) != 0)
+            return -1;
+    } else if (size <= ELIXIR_INLINE_DATA) {
+        if (file_demote(drive, in, size) != 0) return -1;
+    } else {
+        uint32_t bs = m->sb->s_block_size;
+        uint32_t keep = size / bs + (size % bs != 0);
+        if (keep < in->blocks && elixir_shrink(drive, in, in->blocks - keep) != 0)
+            return -1;
+    }
+
+    in->size = size;
+    return 0;
+}
@@ -1,52 +1,47 @@
 #include <fs/elixir.h>
 #include <vga.h>
 #include <mem.h>
-#include <ide.h>
+#include <blk.h>
 
-struct super_block* create_super(uint8_t drive) {
-    extern struct ide_device ide_devices[4];
+struct super_block* create_super(struct arena *arena, uint8_t drive) {
     struct super_block* sb;
     uint16_t sector_size = 512;
     uint32_t total_sectors;
     uint16_t sectors_per_block;
     uint32_t bitmap_size_sectors;
 
-    if (drive >= 4) {
+    if (drive >= BLK_MAX_DRIVES) {
         printf("Error: Invalid drive index %d.\n", drive);
         return NULL;
     }
 
-    total_sectors = ide_devices[drive].Size;
+    total_sectors = blk_size(drive);
 
     printf("Initializing Elixir filesystem on drive %d...\n", drive);
     printf("Drive size: %u sectors (%u MB)\n",
            total_sectors, total_sectors / 2048);
 
     printf("Allocating super_block struct...\n");
-    sb = kmalloc(sizeof(struct super_block));
+    sb = arena_zalloc(arena, sizeof(struct super_block));
     if (!sb) {
         printf("Failed to allocate super_block!\n");
         return NULL;
     }
     printf("Struct allocated\n");
 
-    memset(sb, 0, sizeof(struct super_block));
-
     if (total_sectors < 32768)               return NULL;
     else if (total_sectors < 131072)         sectors_per_block = 2;
     else if (total_sectors < 524288)         sectors_per_block = 4;
     else if (total_sectors < 2097152)        sectors_per_block = 8;
     else if (total_sectors < 8388608)        sectors_per_block = 16;
     else if (total_sectors < 33554432)       sectors_per_block = 32;
-    else if (total_sectors < 134217728)      sectors_per_block = 64;
-    else                                     sectors_per_block = 128;
+    else                                     sectors_per_block = 64;    // s_block_size is 16 bits
 
     sb->s_magic = ELIXIR_MAGIC;
     sb->s_block_size = sector_size * sectors_per_block;
     sb->s_total_blocks = total_sectors / sectors_per_block;
     
-    bitmap_size_sectors = (total_sectors + 4095) / 4096;
-    if (bitmap_size_sectors < 1) bitmap_size_sectors = 1;
+    bitmap_size_sectors = elixir_bitmap_sectors(sb->s_total_blocks);
     
     sb->s_bitmap_start_lba = ELIXIR_BITMAP_START_LBA;
     sb->s_bitmap_blocks = (bitmap_size_sectors + sectors_per_block - 1) / sectors_per_block;
@@ -56,7 +51,7 @@ struct super_block* create_super(uint8_t drive) {
     sb->s_free_blocks = sb->s_total_blocks;
     sb->s_total_inodes = 128;
     sb->s_free_inodes = 128;
-    sb->s_state = 1;
+    sb->s_state = ELIXIR_STATE_CLEAN;
     sb->s_errors = 0;
 
     printf("Superblock initialized:\n");
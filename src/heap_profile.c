@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <heap_profile.h>
+#include <mem.h>
+#include <slab.h>
+#include <pmm.h>
+#include <serial.h>
+#include <commands.h>
+
+static struct heap_profile profile;
+
+static inline int size_bucket(size_t size) {
+    if (size <= 16) return 0;
+    int bucket = (32 - __builtin_clz((uint32_t)size - 1)) - 4;
+    return bucket < HEAP_PROFILE_BUCKETS ? bucket : HEAP_PROFILE_BUCKETS - 1;
+}
+
+static struct heap_site *site_lookup(uintptr_t addr) {
+    uint32_t slot = (uint32_t)(addr * 2654435761u) % HEAP_PROFILE_SITES;
+
+    for (int probe = 0; probe < HEAP_PROFILE_SITES; probe++) {
+        struct heap_site *site = &profile.sites[slot];
+        if (site->addr == addr) return site;
+        if (site->addr == 0) {
+            site->addr = addr;
+            return site;
+        }
+        slot = (slot + 1) % HEAP_PROFILE_SITES;
+    }
+    return NULL;
+}
+
+void heap_profile_alloc(size_t requested, size_t usable, void *caller) {
+    unsigned long flags = save_and_cli();
+
+    profile.allocs++;
+    profile.requested_bytes += requested;
+    profile.usable_bytes += usable;
+    profile.live_bytes += usable;
+    if (profile.live_bytes > profile.peak_bytes)
+        profile.peak_bytes = profile.live_bytes;
+    profile.histogram[size_bucket(requested)]++;
+
+    struct heap_site *site = site_lookup((uintptr_t)caller);
+    if (site) {
+        site->allocs++;
+        site->bytes += requested;
+    } else {
+        profile.untracked++;
+    }
+
+    restore_flags(flags);
+}
+
+void heap_profile_free(size_t usable) {
+    unsigned long flags = save_and_cli();
+    profile.frees++;
+    profile.live_bytes -= usable;
+    restore_flags(flags);
+}
+
+/*
+ * One record per line, "<record> key=value ...", so a host script can
+ * collect and diff heap behaviour across runs.
+ */
+void heap_profile_dump(void) {
+    struct heap_profile snap;
+    struct heap_stats heap;
+    struct slab_class slabs[SLAB_CLASSES];
+    struct pmm_stats pmm;
+
+    unsigned long flags = save_and_cli();
+    snap = profile;
+    restore_flags(flags);
+
+    heap_get_stats(&heap);
+    slab_get_stats(slabs);
+    pmm_get_stats(&pmm);
+
+    serial_printf("heap_profile begin\n");
+    serial_printf("heap live_bytes=%u peak_bytes=%u allocs=%u frees=%u requested_bytes=%u usable_bytes=%u\n",
+                  snap.live_bytes, snap.peak_bytes, snap.allocs, snap.frees,
+                  snap.requested_bytes, snap.usable_bytes);
+    serial_printf("heap_free policy=%u blocks=%u bytes=%u largest=%u frag_permille=%u\n",
+                  heap.policy, heap.free_blocks, heap.free_bytes, heap.largest_free,
+                  heap.frag_permille);
+    serial_printf("heap_ops allocs=%u frees=%u failed=%u splits=%u coalesces=%u search_steps=%u grows=%u\n",
+                  heap.allocs, heap.frees, heap.failed, heap.splits, heap.coalesces,
+                  heap.search_steps, heap.grows);
+
+    for (int i = 0; i < HEAP_PROFILE_BUCKETS; i++) {
+        if (!snap.histogram[i]) continue;
+        if (i == HEAP_PROFILE_BUCKETS - 1)
+            serial_printf("heap_hist le=inf count=%u\n", snap.histogram[i]);
+        else
+            serial_printf("heap_hist le=%u count=%u\n", 16u << i, snap.histogram[i]);
+    }
+
+    for (int i = 0; i < HEAP_PROFILE_SITES; i++) {
+        const struct heap_site *site = &snap.sites[i];
+        if (!site->addr) continue;
+        serial_printf("heap_site addr=0x%x allocs=%u bytes=%u\n",
+                      (uint32_t)site->addr, site->allocs, site->bytes);
+    }
+    if (snap.untracked)
+        serial_printf("heap_site addr=other allocs=%u\n", snap.untracked);
+
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        serial_printf("slab size=%u pages=%u in_use=%u\n",
+                      slabs[i].size, slabs[i].pages, slabs[i].in_use);
+    }
+
+    serial_printf("pmm total_pages=%u free_pages=%u zero_pool_hits=%u zero_pool_misses=%u\n",
+                  pmm.total_pages, pmm.free_pages, pmm.zero_pool_hits, pmm.zero_pool_misses);
+    serial_printf("heap_profile end\n");
+}
@@ -80,6 +80,9 @@ isr_common_stub:
     mov eax, esp
     push eax
     
+    ; The C ABI expects DF=0, whatever the interrupted code left
+    cld
+
     ; Call C fault handler
     call fault_handler
     
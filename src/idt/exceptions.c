@@ -2,6 +2,7 @@
 #include <vga.h>
 #include <exceptions.h>
 #include <isr.h>
+#include <commands.h>
 
 // Exception messages
 static const char *exception_messages[] = {
@@ -44,6 +45,8 @@ void fault_handler(struct regs *r) {
         printf("\n*** EXCEPTION ***\n");
         printf("Exception: %s\n", exception_messages[r->int_no]);
         printf("Error Code: 0x%X\n", r->err_code);
+        if (r->int_no == 14)
+            printf("Fault Address: 0x%X\n", read_cr2());
         printf("\n");
         printf("Register Dump:\n");
         printf("  EIP: 0x%X  CS: 0x%X  EFLAGS: 0x%X\n", r->eip, r->cs, r->eflags);
@@ -3,6 +3,7 @@
 #include <commands.h>
 #include <irq.h>
 #include <pic.h>
+#include <cpu.h>
 
 struct idt_entry idt[256];
 struct idt_ptr idtp;
@@ -16,6 +17,8 @@ struct regs {
 
 static void (*irq_handlers[16])(void) = {0};
 
+volatile uint32_t irq_nesting = 0;
+
 extern void idt_load(unsigned int);
 
 void idt_set_gate(unsigned char num, unsigned long base, unsigned short sel, unsigned char flags) {
@@ -80,6 +83,8 @@ void install_irq_handler(int n, void (*handler)(void)) {
 void irq_handler(struct regs *r) {
     int irq = r->int_no - 32;
 
+    irq_nesting++;
+
     // Check if we have a custom handler for this IRQ
     if (irq >= 0 && irq < 16 && irq_handlers[irq]) {
         irq_handlers[irq](); // Call the device-specific C handler (e.g., on_irq0)
@@ -90,4 +95,6 @@ void irq_handler(struct regs *r) {
         outb(0xA0, 0x20); 
     }
     outb(0x20, 0x20); // Master PIC
+
+    irq_nesting--;
 }
\ No newline at end of file
@@ -59,6 +59,9 @@ irq_common_stub:
     mov eax, esp
     push eax
     
+    ; The C ABI expects DF=0, whatever the interrupted code left
+    cld
+
     ; Call C IRQ handler
     call irq_handler
     
@@ -0,0 +1,160 @@
+#include <clock.h>
+#include <timer.h>
+#include <cpu.h>
+#include <commands.h>
+#include <vga.h>
+
+static uint32_t tsc_khz = 0;
+static uint64_t tsc_base = 0;
+
+// Fixed-point conversion factors, computed once at calibration
+static uint32_t ns_per_cycle_q22 = 0;   // ns = cycles * x >> 22
+static uint32_t cycles_per_ns_q22 = 0;  // cycles = ns * x >> 22
+static uint32_t cycles_per_us_q12 = 0;  // cycles = us * x >> 12
+
+// 64-by-32 division using divl twice, since there is no libgcc
+static uint64_t div64_u32(uint64_t n, uint32_t d) {
+    uint32_t hi = (uint32_t)(n >> 32), lo = (uint32_t)n;
+    uint32_t q_hi = hi / d, r = hi % d, q_lo;
+
+    asm ("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+/* ============================================================================
+ * CALIBRATION
+ * ============================================================================ */
+
+static uint16_t pit_read_counter(void) {
+    outb(0x43, 0x00);       // Latch channel 0
+    uint8_t lo = inb(0x40);
+    uint8_t hi = inb(0x40);
+    return (uint16_t)(lo | (hi << 8));
+}
+
+// Count TSC cycles across a one-shot countdown on PIT channel 0. Must run
+// with interrupts off and before init_timer() programs the periodic rate.
+void clock_init(void) {
+    if (!cpu_has(CPUID_EDX_TSC)) {
+        printf("Clock: no TSC, delays use port I/O timing\n");
+        return;
+    }
+
+    uint32_t count = PIT_HZ / 1000 * CLOCK_CALIBRATE_MS;
+    unsigned long flags = save_and_cli();
+
+    // Channel 0, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(0x43, 0x30);
+    outb(0x40, count & 0xFF);
+    outb(0x40, (count >> 8) & 0xFF);
+
+    // Start timing on the first decrement so the load latency is not counted
+    uint16_t first = pit_read_counter();
+    uint16_t now;
+    while ((now = pit_read_counter()) == first);
+    uint64_t start = rdtsc();
+    first = now;
+
+    uint16_t last = first;
+    while (1) {
+        now = pit_read_counter();
+        if (now > last || now < 16) break;      // Reached zero and wrapped
+        last = now;
+    }
+    uint64_t cycles = rdtsc() - start;
+    restore_flags(flags);
+
+    uint32_t ticks = first - last;
+    if (ticks == 0 || cycles >> 32) {
+        printf("Clock: TSC calibration failed\n");
+        return;
+    }
+
+    // khz = cycles * PIT_HZ / ticks / 1000
+    tsc_khz = (uint32_t)div64_u32((uint64_t)(uint32_t)cycles * (PIT_HZ / 2), ticks * 500u);
+    if (tsc_khz == 0) return;
+
+    ns_per_cycle_q22 = (uint32_t)div64_u32(1000000ull << 22, tsc_khz);
+    cycles_per_ns_q22 = (uint32_t)div64_u32((uint64_t)tsc_khz << 22, 1000000);
+    cycles_per_us_q12 = (uint32_t)div64_u32((uint64_t)tsc_khz << 12, 1000);
+    tsc_base = rdtsc();
+
+    printf("Clock: TSC at %u.%u MHz\n", tsc_khz / 1000, (tsc_khz / 100) % 10);
+}
+
+uint32_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+/* ============================================================================
+ * TIME AND DELAYS
+ * ============================================================================ */
+
+// Nanoseconds since calibration, or whole timer ticks without a TSC
+uint64_t ktime_ns(void) {
+    if (!tsc_khz) return get_timer_ticks() * (1000000000ull / TIMER_HZ);
+
+    uint64_t cycles = rdtsc() - tsc_base;
+    uint64_t hi = (uint64_t)(uint32_t)(cycles >> 32) * ns_per_cycle_q22;
+    uint64_t lo = (uint64_t)(uint32_t)cycles * ns_per_cycle_q22;
+    return (hi << 10) + (lo >> 22);
+}
+
+static void tsc_spin(uint64_t cycles) {
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < cycles)
+        asm volatile ("pause");
+}
+
+void ndelay(uint32_t ns) {
+    if (!tsc_khz) {
+        for (uint32_t i = 0; i < (ns + 999) / 1000; i++) io_wait();
+        return;
+    }
+    tsc_spin(((uint64_t)ns * cycles_per_ns_q22 >> 22) + 1);
+}
+
+void udelay(uint32_t us) {
+    if (!tsc_khz) {
+        for (uint32_t i = 0; i < us; i++) io_wait();
+        return;
+    }
+    tsc_spin(((uint64_t)us * cycles_per_us_q12 >> 12) + 1);
+}
+
+// Wait at least ns: halt through whole timer ticks when interrupts are on,
+// then spin out the remainder
+void clock_sleep_ns(uint64_t ns) {
+    uint64_t deadline = ktime_ns() + ns;
+    const uint64_t tick_ns = 1000000000ull / TIMER_HZ;
+
+    unsigned long flags = read_eflags();
+
+    if (!tsc_khz) {
+        // Tick granularity only; one extra tick covers the partial first one
+        if ((flags & EFLAGS_IF) && !irq_nesting) {
+            timer_wait((uint32_t)div64_u32(ns + tick_ns - 1, (uint32_t)tick_ns) + 1);
+            return;
+        }
+
+        // No tick will arrive to end a hlt; count out port delays instead
+        uint64_t us = div64_u32(ns + 999, 1000);
+        while (us) {
+            uint32_t step = us > 1000 ? 1000 : (uint32_t)us;
+            udelay(step);
+            us -= step;
+        }
+        return;
+    }
+
+    uint64_t now;
+    while ((now = ktime_ns()) < deadline) {
+        uint64_t left = deadline - now;
+        if ((flags & EFLAGS_IF) && !irq_nesting && left > tick_ns)
+            asm volatile ("hlt");
+        else if (left > 1000000)
+            udelay(1000);
+        else
+            ndelay((uint32_t)left);
+    }
+}
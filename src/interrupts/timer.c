@@ -2,6 +2,7 @@
 #include <commands.h>
 #include <pic.h>
 #include <vga.h>
+#include <pmm.h>
 #include <stdint.h>
 
 static volatile uint64_t timer_ticks = 0;
@@ -13,13 +14,15 @@ void on_irq0(void) {
 void timer_wait(uint32_t ticks) {
     uint64_t start_ticks = timer_ticks;
     while (timer_ticks < start_ticks + ticks) {
+        pmm_idle();
+        if (timer_ticks >= start_ticks + ticks) break;
         asm volatile ("hlt"); 
     }
 }
 
 void init_timer(void) {
-    // Set PIT frequency to ~100Hz (1193180 / 11932 ≈ 100)
-    uint16_t divisor = 11932;
+    // Set PIT frequency to ~100Hz (1193182 / 11931 ≈ 100)
+    uint16_t divisor = PIT_HZ / TIMER_HZ;
 
     // Command Port (0x43): Channel 0, Access LOBYTE/HIBYTE, Mode 3 (Square Wave), Binary
     outb(0x43, 0x36); 
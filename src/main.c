@@ -4,12 +4,28 @@
 #include <exceptions.h>
 #include <irq.h>
 #include <timer.h>
+#include <clock.h>
 #include <mem.h>
+#include <pmm.h>
+#include <arena.h>
+#include <paging.h>
 #include <ide.h>
 #include <fs/elixir.h>
+#include <cpu.h>
+#include <memops.h>
+#include <serial.h>
+#include <bench.h>
+#include <heap_profile.h>
+#include <blk.h>
+#include <bcache.h>
 
 void kmain(void) {
-    init_allocator_region(0x00100000, 2 * 1024 * 1024 * 1024);
+    serial_init();
+    cpu_init();
+    memops_init();
+
+    pmm_init();
+    heap_init();
     
     printf("Initializing GDT...\n");
     gdt_install(); 
@@ -20,11 +36,15 @@ void kmain(void) {
     printf("Installing Exception Handlers...\n");
     exceptions_install();
     
+    printf("Enabling paging...\n");
+    paging_init();
+
     printf("Installing IRQ Handlers...\n");
     irq_install();
     
     install_irq_handler(0, on_irq0); 
     
+    clock_init();
     init_timer();
     
     clear_screen();
@@ -32,18 +52,38 @@ void kmain(void) {
     asm volatile ("sti");
     printf("Welcome To BinbowsDOS!\n");
 
+#ifdef KERNEL_BENCH
+    mem_bench();
+#endif
+
     printf("Detecting IDE devices...\n");
     ide_initialize();
+    blk_ide_init();
     printf("IDE devices detected and initialized.\n");
 
     uint8_t drive = 1;
 
+#ifdef KERNEL_BENCH
+    ide_bench(drive);
+#endif
+
     printf("Formatting drive %d\n", drive);
     elixir_format(drive);
-    elixir_mount(drive, NULL);
+    struct arena *fs_arena = arena_create(ARENA_DEFAULT_ORDER);
+    elixir_mount(fs_arena, drive, NULL);
     printf("Drive %d formatted with Elixir filesystem.\n", drive);
 
+#ifdef KERNEL_BENCH
+    dir_bench(drive);
+#endif
+
+    heap_profile_dump();
+    blk_dump_stats();
+    bcache_dump_stats();
+
     while (1) {
+        pmm_idle();
+        bcache_idle();
         asm volatile ("hlt"); 
     }
 }
\ No newline at end of file
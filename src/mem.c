@@ -1,178 +1,388 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <vga.h>
+#include <commands.h>
 #include <mem.h>
+#include <slab.h>
+#include <pmm.h>
+#include <heap_profile.h>
 
-#define MIN_ALLOC_SIZE 16
 #define ALIGN_SIZE 8
-#define PAGE_SIZE 4096
 
-static free_list_block *free_list_head = NULL;
+static heap_block *free_list_head = NULL;
+static heap_block *next_fit_rover = NULL;
+static enum heap_policy heap_policy = HEAP_FIRST_FIT;
+static struct heap_stats heap_counters;
+static int heap_ready = 0;
 
-static inline unsigned long save_and_cli(void) {
-    unsigned long flags;
-    __asm__ volatile("pushf; pop %0" : "=r"(flags));
-    __asm__ volatile("cli");
-    return flags;
+static size_t align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
 }
 
-// Restore flags if interrupts were enabled
-static inline void restore_flags(unsigned long flags) {
-    if (flags & (1 << 9))
-        __asm__ volatile("sti");
+/* ============================================================================
+ * BOUNDARY TAGS
+ * ============================================================================ */
+
+static inline uint32_t block_size(const heap_block *block) {
+    return block->size & ~HEAP_TAG_USED;
 }
 
-static size_t align_up(size_t size, size_t alignment) {
-    return (size + alignment - 1) & ~(alignment - 1);
+static inline int block_used(const heap_block *block) {
+    return block->size & HEAP_TAG_USED;
+}
+
+static inline void set_tags(heap_block *block, uint32_t size, uint32_t used) {
+    block->size = size | used;
+    block->magic = HEAP_MAGIC;
+    *(uint32_t *)((uint8_t *)block + size - HEAP_FOOTER_SIZE) = size | used;
 }
 
-static void memset_page(void *ptr, int value, size_t size) {
-    uint8_t *p = (uint8_t *)ptr;
-    for (size_t i = 0; i < size; i++)
-        p[i] = (uint8_t)value;
+static inline heap_block *next_block(const heap_block *block) {
+    return (heap_block *)((uint8_t *)block + block_size(block));
 }
 
-static void insert_free_block_sorted(free_list_block *block) {
-    if (!block) return;
+// Footer of the physically preceding block; the region prologue reads as used
+static inline uint32_t prev_tag(const heap_block *block) {
+    return *((const uint32_t *)block - 1);
+}
 
-    free_list_block **cur = &free_list_head;
-    while (*cur && *cur < block)
-        cur = &(*cur)->next;
+/* ============================================================================
+ * FREE LIST
+ * ============================================================================ */
 
-    block->next = *cur;
-    *cur = block;
+static void free_list_push(heap_block *block) {
+    block->prev = NULL;
+    block->next = free_list_head;
+    if (free_list_head) free_list_head->prev = block;
+    free_list_head = block;
 
-    // Merge with next block (coalescing forward)
-    if (block->next && (uint8_t*)block + sizeof(free_list_block) + block->size == (uint8_t*)block->next) {
-        block->size += sizeof(free_list_block) + block->next->size;
-        block->next = block->next->next;
+    heap_counters.free_blocks++;
+    heap_counters.free_bytes += block_size(block);
+}
+
+static void free_list_remove(heap_block *block) {
+    if (block->prev) block->prev->next = block->next;
+    else free_list_head = block->next;
+    if (block->next) block->next->prev = block->prev;
+
+    if (next_fit_rover == block) next_fit_rover = block->next;
+
+    heap_counters.free_blocks--;
+    heap_counters.free_bytes -= block_size(block);
+}
+
+static heap_block *find_fit(uint32_t need) {
+    heap_block *block;
+
+    switch (heap_policy) {
+    case HEAP_NEXT_FIT: {
+        heap_block *start = next_fit_rover ? next_fit_rover : free_list_head;
+        block = start;
+        while (block) {
+            heap_counters.search_steps++;
+            if (block_size(block) >= need) return block;
+            block = block->next ? block->next : free_list_head;
+            if (block == start) break;
+        }
+        return NULL;
     }
 
-    // Merge with previous block (coalescing backward)
-    if (cur != &free_list_head) {
-        free_list_block *prev = free_list_head;
-        // Search for the block *before* 'block'
-        while (prev && prev->next != block) prev = prev->next;
-        if (prev && (uint8_t*)prev + sizeof(free_list_block) + prev->size == (uint8_t*)block) {
-            prev->size += sizeof(free_list_block) + block->size;
-            prev->next = block->next;
+    case HEAP_BEST_FIT: {
+        heap_block *best = NULL;
+        for (block = free_list_head; block; block = block->next) {
+            heap_counters.search_steps++;
+            uint32_t size = block_size(block);
+            if (size >= need && (!best || size < block_size(best))) {
+                best = block;
+                if (size == need) break;
+            }
+        }
+        return best;
+    }
+
+    case HEAP_FIRST_FIT:
+    default:
+        for (block = free_list_head; block; block = block->next) {
+            heap_counters.search_steps++;
+            if (block_size(block) >= need) return block;
         }
+        return NULL;
     }
 }
 
-void init_allocator_region(uint32_t region_base, uint32_t region_size) {
-    printf("Initializing allocator region: 0x%x - 0x%x (%u KB)\n",
-           region_base, region_base + region_size, region_size / 1024);
+/* ============================================================================
+ * ALLOCATOR
+ * ============================================================================ */
+
+static int heap_add_region(uint32_t base, uint32_t size) {
+    uint32_t start = align_up(base, ALIGN_SIZE);
+    if (size <= (start - base) + 2 * HEAP_HEADER_SIZE + HEAP_MIN_BLOCK)
+        return -1;
+    size = (size - (start - base)) & ~(ALIGN_SIZE - 1);
+
+    // Prologue footer and epilogue header stop coalescing at the region edges
+    *(uint32_t *)(start + HEAP_HEADER_SIZE - HEAP_FOOTER_SIZE) = HEAP_TAG_USED;
+    heap_block *epilogue = (heap_block *)(start + size - HEAP_HEADER_SIZE);
+    epilogue->size = HEAP_TAG_USED;
+    epilogue->magic = HEAP_MAGIC;
+
+    heap_block *block = (heap_block *)(start + HEAP_HEADER_SIZE);
+    set_tags(block, size - 2 * HEAP_HEADER_SIZE, 0);
+    free_list_push(block);
+    return 0;
+}
+
+// Extend the heap with a block of pages large enough for a 'need'-byte block
+static int heap_grow(uint32_t need) {
+    unsigned int order = size_to_order(need + 2 * HEAP_HEADER_SIZE);
+    if (order < HEAP_GROW_ORDER) order = HEAP_GROW_ORDER;
+
+    uint8_t *pages = alloc_pages(order);
+    if (!pages) return -1;
+
+    struct page *page = virt_to_page(pages);
+    for (uint32_t i = 0; i < (1u << order); i++)
+        page[i].flags = PG_HEAP;
+
+    heap_counters.grows++;
+    return heap_add_region((uint32_t)pages, PAGE_SIZE << order);
+}
+
+void heap_init(void) {
+    slab_init();
 
-    uint32_t aligned_start = align_up(region_base, ALIGN_SIZE);
-    
-    // Check if the region is too small after alignment adjustment
-    if (region_size <= sizeof(free_list_block) + (aligned_start - region_base)) {
-        printf("Region too small to use for allocator\n");
+    if (heap_grow((PAGE_SIZE << HEAP_INITIAL_ORDER) - 2 * HEAP_HEADER_SIZE) != 0) {
+        printf("Heap: no pages for the initial region\n");
         return;
     }
-    
-    // Adjust size for the alignment offset
-    region_size -= (aligned_start - region_base);
 
-    free_list_head = (free_list_block *)aligned_start;
-    free_list_head->size = region_size - sizeof(free_list_block);
-    free_list_head->next = NULL;
-
-    printf("Allocator ready: base=0x%x, size=%u bytes\n", aligned_start, free_list_head->size);
+    heap_ready = 1;
+    printf("Allocator ready: %u bytes\n", heap_counters.free_bytes);
 }
 
-void *kmalloc(size_t size) {
-    if (size == 0) return NULL;
+void heap_set_policy(enum heap_policy policy) {
+    unsigned long flags = save_and_cli();
+    heap_policy = policy;
+    next_fit_rover = NULL;
+    restore_flags(flags);
+}
 
-    size = align_up(size, ALIGN_SIZE);
-    if (size < MIN_ALLOC_SIZE) size = MIN_ALLOC_SIZE;
+void heap_get_stats(struct heap_stats *out) {
+    unsigned long flags = save_and_cli();
+    *out = heap_counters;
+    out->policy = heap_policy;
+    out->largest_free = 0;
+    for (heap_block *block = free_list_head; block; block = block->next) {
+        if (block_size(block) > out->largest_free)
+            out->largest_free = block_size(block);
+    }
+    restore_flags(flags);
 
-    if (!free_list_head) {
-        printf("kmalloc: allocator not initialized!\n");
-        return NULL;
+    // Scale down so the per-mille product stays within 32 bits
+    uint32_t largest = out->largest_free, total = out->free_bytes;
+    while (total > 0x00400000) {
+        largest >>= 1;
+        total >>= 1;
     }
+    out->frag_permille = total ? 1000 - largest * 1000 / total : 0;
+}
+
+// Walk the free list and verify its tags and counters; returns the number of problems
+int heap_check(void) {
+    int errors = 0;
+    uint32_t blocks = 0, bytes = 0;
 
     unsigned long flags = save_and_cli();
-    free_list_block **current = &free_list_head;
-
-    while (*current) {
-        printf("Current\n");
-        free_list_block *block = *current;
-        if (block->size >= size) {
-            // Split block if remaining space is large enough for another header + min block
-            if (block->size >= size + sizeof(free_list_block) + MIN_ALLOC_SIZE) {
-                free_list_block *new_block =
-                    (free_list_block *)((uint8_t *)block + sizeof(free_list_block) + size);
-                new_block->size = block->size - size - sizeof(free_list_block);
-                new_block->next = block->next;
-                *current = new_block; // The new (smaller) free block replaces the old one
-                block->size = size;    // Set the allocated block's size
-            } else {
-                // Not enough space to split, allocate the whole block
-                *current = block->next;
-            }
+    for (heap_block *block = free_list_head; block; block = block->next) {
+        uint32_t size = block_size(block);
+        const heap_block *next = next_block(block);
 
-            restore_flags(flags);
-            void *result = (uint8_t *)block + sizeof(free_list_block);
-            memset_page(result, 0, size);
-            return result;
+        if (block->magic != HEAP_MAGIC || block_used(block)) {
+            printf("heap_check: bad header at 0x%x\n", (uint32_t)block);
+            errors++;
+            break;
+        }
+        if (size < HEAP_MIN_BLOCK || (size & (ALIGN_SIZE - 1))) {
+            printf("heap_check: bad size %u at 0x%x\n", size, (uint32_t)block);
+            errors++;
+            break;
+        }
+        if (*((const uint32_t *)next - 1) != block->size) {
+            printf("heap_check: footer mismatch at 0x%x\n", (uint32_t)block);
+            errors++;
+        }
+        if (block->next && block->next->prev != block) {
+            printf("heap_check: broken link after 0x%x\n", (uint32_t)block);
+            errors++;
         }
-        current = &((*current)->next);
+        if (!block_used(next) || !(prev_tag(block) & HEAP_TAG_USED)) {
+            printf("heap_check: uncoalesced neighbour at 0x%x\n", (uint32_t)block);
+            errors++;
+        }
+
+        blocks++;
+        bytes += size;
     }
 
+    if (blocks != heap_counters.free_blocks || bytes != heap_counters.free_bytes) {
+        printf("heap_check: counters say %u blocks/%u bytes, list has %u/%u\n",
+               heap_counters.free_blocks, heap_counters.free_bytes, blocks, bytes);
+        errors++;
+    }
     restore_flags(flags);
-    printf("kmalloc: out of memory for %u bytes\n", size);
-    return NULL;
+
+    return errors;
 }
 
-void kfree(void *ptr) {
-    if (!ptr) return;
-    free_list_block *block = (free_list_block *)((uint8_t *)ptr - sizeof(free_list_block));
+static void *heap_alloc(size_t size) {
+    size = align_up(size, ALIGN_SIZE);
+
+    if (!heap_ready) {
+        printf("kmalloc: allocator not initialized!\n");
+        return NULL;
+    }
+
+    // Small requests are served from the size-class slabs in O(1)
+    if (size <= SLAB_MAX_SIZE) {
+        void *obj = slab_alloc(size);
+        if (obj) return obj;
+    }
+
+    // No heap block outgrows one buddy block; larger sizes would also wrap need
+    if (size > (PAGE_SIZE << MAX_ORDER)) {
+        heap_counters.failed++;
+        printf("kmalloc: out of memory for %u bytes\n", size);
+        return NULL;
+    }
+
+    uint32_t need = size + HEAP_HEADER_SIZE + HEAP_FOOTER_SIZE;
+    need = align_up(need, ALIGN_SIZE);
+    if (need < HEAP_MIN_BLOCK) need = HEAP_MIN_BLOCK;
+
     unsigned long flags = save_and_cli();
-    insert_free_block_sorted(block);
+    heap_block *block = find_fit(need);
+    if (!block && heap_grow(need) == 0)
+        block = find_fit(need);
+    if (!block) {
+        heap_counters.failed++;
+        restore_flags(flags);
+        printf("kmalloc: out of memory for %u bytes\n", size);
+        return NULL;
+    }
+
+    free_list_remove(block);
+
+    // Split block if the remainder can hold another free block
+    uint32_t total = block_size(block);
+    if (total - need >= HEAP_MIN_BLOCK) {
+        set_tags(block, need, HEAP_TAG_USED);
+        heap_block *rest = next_block(block);
+        set_tags(rest, total - need, 0);
+        free_list_push(rest);
+        if (heap_policy == HEAP_NEXT_FIT) next_fit_rover = rest;
+        heap_counters.splits++;
+    } else {
+        set_tags(block, total, HEAP_TAG_USED);
+    }
+
+    heap_counters.allocs++;
     restore_flags(flags);
+
+    return (uint8_t *)block + HEAP_HEADER_SIZE;
 }
 
-void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
-    uint8_t *restrict pdest = (uint8_t *restrict)dest;
-    const uint8_t *restrict psrc = (const uint8_t *restrict)src;
-    for (size_t i = 0; i < n; i++) {
-        pdest[i] = psrc[i];
-    }
-    return dest;
+size_t ksize(const void *ptr) {
+    if (!ptr) return 0;
+    if (slab_owns(ptr)) return slab_size(ptr);
+
+    struct page *page = virt_to_page(ptr);
+    if (page && (page->flags & PG_LARGE))
+        return PAGE_SIZE << page->order;
+
+    const heap_block *block = (const heap_block *)((const uint8_t *)ptr - HEAP_HEADER_SIZE);
+    return block_size(block) - HEAP_HEADER_SIZE - HEAP_FOOTER_SIZE;
 }
 
-void *memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
-    for (size_t i = 0; i < n; i++) {
-        p[i] = (uint8_t)c;
-    }
-    return s;
+void *kmalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    void *ptr = heap_alloc(size);
+    if (ptr) heap_profile_alloc(size, ksize(ptr), __builtin_return_address(0));
+    return ptr;
 }
 
-void *memmove(void *dest, const void *src, size_t n) {
-    uint8_t *pdest = (uint8_t *)dest;
-    const uint8_t *psrc = (const uint8_t *)src;
-    if (src > dest) {
-        for (size_t i = 0; i < n; i++) {
-            pdest[i] = psrc[i];
-        }
-    } else if (src < dest) {
-        for (size_t i = n; i > 0; i--) {
-            pdest[i-1] = psrc[i-1];
+void *kzalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    void *ptr;
+
+    // Page-sized requests come pre-zeroed from the idle-time pool
+    if (size >= PAGE_SIZE) {
+        unsigned int order = size_to_order(size);
+        ptr = alloc_zeroed_pages(order);
+        if (!ptr) {
+            printf("kzalloc: out of memory for %u bytes\n", size);
+            return NULL;
         }
+        struct page *page = virt_to_page(ptr);
+        page->flags = PG_LARGE;
+        page->order = (uint8_t)order;
+    } else {
+        ptr = heap_alloc(size);
+        if (!ptr) return NULL;
+        memset(ptr, 0, size);
     }
-    return dest;
+
+    heap_profile_alloc(size, ksize(ptr), __builtin_return_address(0));
+    return ptr;
 }
 
-int memcmp(const void *s1, const void *s2, size_t n) {
-    const uint8_t *p1 = (const uint8_t *)s1;
-    const uint8_t *p2 = (const uint8_t *)s2;
-    for (size_t i = 0; i < n; i++) {
-        if (p1[i] != p2[i]) {
-            return p1[i] < p2[i] ? -1 : 1;
-        }
+void kfree(void *ptr) {
+    if (!ptr) return;
+    if (slab_owns(ptr)) {
+        heap_profile_free(slab_size(ptr));
+        slab_free(ptr);
+        return;
     }
-    return 0;
-}
\ No newline at end of file
+
+    struct page *page = virt_to_page(ptr);
+    if (page && (page->flags & PG_LARGE)) {
+        heap_profile_free(PAGE_SIZE << page->order);
+        free_pages(ptr, page->order);
+        return;
+    }
+
+    heap_block *block = (heap_block *)((uint8_t *)ptr - HEAP_HEADER_SIZE);
+    if (block->magic != HEAP_MAGIC || !block_used(block)) {
+        printf("kfree: invalid or double free of 0x%x\n", (uint32_t)ptr);
+        return;
+    }
+    heap_profile_free(ksize(ptr));
+
+    unsigned long flags = save_and_cli();
+    uint32_t size = block_size(block);
+    block->magic = 0;
+
+    // Merge with next block (coalescing forward)
+    heap_block *next = next_block(block);
+    if (!block_used(next)) {
+        free_list_remove(next);
+        size += block_size(next);
+        heap_counters.coalesces++;
+    }
+
+    // Merge with previous block (coalescing backward)
+    uint32_t tag = prev_tag(block);
+    if (!(tag & HEAP_TAG_USED)) {
+        heap_block *prev = (heap_block *)((uint8_t *)block - tag);
+        free_list_remove(prev);
+        size += tag;
+        block = prev;
+        heap_counters.coalesces++;
+    }
+
+    set_tags(block, size, 0);
+    free_list_push(block);
+    heap_counters.frees++;
+    restore_flags(flags);
+}
@@ -0,0 +1,378 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <mem.h>
+#include <memops.h>
+#include <cpu.h>
+#include <commands.h>
+#include <vga.h>
+
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+/* ============================================================================
+ * BYTE LOOPS
+ * ============================================================================ */
+
+static void *copy_byte(void *dest, const void *src, size_t n) {
+    uint8_t *pdest = (uint8_t *)dest;
+    const uint8_t *psrc = (const uint8_t *)src;
+    for (size_t i = 0; i < n; i++) {
+        pdest[i] = psrc[i];
+    }
+    return dest;
+}
+
+static void *set_byte(void *s, int c, size_t n) {
+    uint8_t *p = (uint8_t *)s;
+    for (size_t i = 0; i < n; i++) {
+        p[i] = (uint8_t)c;
+    }
+    return s;
+}
+
+static int cmp_byte(const void *s1, const void *s2, size_t n) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    for (size_t i = 0; i < n; i++) {
+        if (p1[i] != p2[i]) {
+            return p1[i] < p2[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* ============================================================================
+ * 32-BIT WORD LOOPS
+ * ============================================================================ */
+
+static void *copy_word(void *dest, const void *src, size_t n) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+
+    // Align the destination; x86 tolerates the misaligned source loads
+    while (n && ((uintptr_t)d & 3)) {
+        *d++ = *s++;
+        n--;
+    }
+    for (; n >= 4; n -= 4, d += 4, s += 4)
+        *(word_t *)d = *(const word_t *)s;
+    while (n--)
+        *d++ = *s++;
+
+    return dest;
+}
+
+static void *set_word(void *s, int c, size_t n) {
+    uint8_t *d = (uint8_t *)s;
+    uint32_t pattern = (uint8_t)c * 0x01010101u;
+
+    while (n && ((uintptr_t)d & 3)) {
+        *d++ = (uint8_t)c;
+        n--;
+    }
+    for (; n >= 4; n -= 4, d += 4)
+        *(word_t *)d = pattern;
+    while (n--)
+        *d++ = (uint8_t)c;
+
+    return s;
+}
+
+static int cmp_word(const void *s1, const void *s2, size_t n) {
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+
+    for (; n >= 4; n -= 4, p1 += 4, p2 += 4) {
+        if (*(const word_t *)p1 != *(const word_t *)p2) break;
+    }
+    return cmp_byte(p1, p2, n);
+}
+
+/* ============================================================================
+ * STRING INSTRUCTIONS
+ * ============================================================================ */
+
+static void *copy_rep(void *dest, const void *src, size_t n) {
+    void *d = dest;
+    const void *s = src;
+    size_t dwords = n >> 2;
+    size_t bytes = n & 3;
+
+    asm volatile ("rep movsl" : "+D"(d), "+S"(s), "+c"(dwords) : : "memory");
+    asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(bytes) : : "memory");
+    return dest;
+}
+
+static void *set_rep(void *s, int c, size_t n) {
+    void *d = s;
+    size_t dwords = n >> 2;
+    size_t bytes = n & 3;
+    uint32_t pattern = (uint8_t)c * 0x01010101u;
+
+    asm volatile ("rep stosl" : "+D"(d), "+c"(dwords) : "a"(pattern) : "memory");
+    asm volatile ("rep stosb" : "+D"(d), "+c"(bytes) : "a"(pattern) : "memory");
+    return s;
+}
+
+/* ============================================================================
+ * SSE2
+ * ============================================================================ */
+
+// 64 bytes per iteration: unaligned loads, aligned (or streaming) stores
+__attribute__((target("sse2")))
+static void sse2_copy_blocks(uint8_t *d, const uint8_t *s, size_t blocks, int stream) {
+    if (stream) {
+        asm volatile (
+            "1:\n\t"
+            "movdqu   (%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movntdq %%xmm0,   (%0)\n\t"
+            "movntdq %%xmm1, 16(%0)\n\t"
+            "movntdq %%xmm2, 32(%0)\n\t"
+            "movntdq %%xmm3, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "add $64, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b\n\t"
+            "sfence"
+            : "+r"(d), "+r"(s), "+r"(blocks)
+            :
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    } else {
+        asm volatile (
+            "1:\n\t"
+            "movdqu   (%1), %%xmm0\n\t"
+            "movdqu 16(%1), %%xmm1\n\t"
+            "movdqu 32(%1), %%xmm2\n\t"
+            "movdqu 48(%1), %%xmm3\n\t"
+            "movdqa %%xmm0,   (%0)\n\t"
+            "movdqa %%xmm1, 16(%0)\n\t"
+            "movdqa %%xmm2, 32(%0)\n\t"
+            "movdqa %%xmm3, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "add $64, %1\n\t"
+            "dec %2\n\t"
+            "jnz 1b"
+            : "+r"(d), "+r"(s), "+r"(blocks)
+            :
+            : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+}
+
+static void *copy_sse2(void *dest, const void *src, size_t n) {
+    if (n < 64 || !kernel_simd_usable())
+        return copy_rep(dest, src, n);
+
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    copy_rep(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t blocks = n >> 6;
+    if (blocks) {
+        sse2_copy_blocks(d, s, blocks, n >= MEMOPS_NT_THRESHOLD);
+        d += blocks << 6;
+        s += blocks << 6;
+    }
+    copy_rep(d, s, n & 63);
+
+    return dest;
+}
+
+__attribute__((target("sse2")))
+static void sse2_set_blocks(uint8_t *d, uint32_t pattern, size_t blocks, int stream) {
+    if (stream) {
+        asm volatile (
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movntdq %%xmm0,   (%0)\n\t"
+            "movntdq %%xmm0, 16(%0)\n\t"
+            "movntdq %%xmm0, 32(%0)\n\t"
+            "movntdq %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b\n\t"
+            "sfence"
+            : "+r"(d), "+r"(blocks) : "r"(pattern) : "memory", "xmm0");
+    } else {
+        asm volatile (
+            "movd %2, %%xmm0\n\t"
+            "pshufd $0, %%xmm0, %%xmm0\n\t"
+            "1:\n\t"
+            "movdqa %%xmm0,   (%0)\n\t"
+            "movdqa %%xmm0, 16(%0)\n\t"
+            "movdqa %%xmm0, 32(%0)\n\t"
+            "movdqa %%xmm0, 48(%0)\n\t"
+            "add $64, %0\n\t"
+            "dec %1\n\t"
+            "jnz 1b"
+            : "+r"(d), "+r"(blocks) : "r"(pattern) : "memory", "xmm0");
+    }
+}
+
+static void *set_sse2(void *s, int c, size_t n) {
+    if (n < 64 || !kernel_simd_usable())
+        return set_rep(s, c, n);
+
+    uint8_t *d = (uint8_t *)s;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    set_rep(d, c, head);
+    d += head;
+    n -= head;
+
+    size_t blocks = n >> 6;
+    if (blocks) {
+        sse2_set_blocks(d, (uint8_t)c * 0x01010101u, blocks, n >= MEMOPS_NT_THRESHOLD);
+        d += blocks << 6;
+    }
+    set_rep(d, c, n & 63);
+
+    return s;
+}
+
+// Returns the offset of the first 16-byte chunk that differs, or n rounded down
+__attribute__((target("sse2")))
+static size_t sse2_cmp_chunks(const uint8_t *p1, const uint8_t *p2, size_t chunks) {
+    size_t offset = 0;
+    uint32_t mask;
+
+    while (chunks--) {
+        asm volatile (
+            "movdqu (%1), %%xmm0\n\t"
+            "movdqu (%2), %%xmm1\n\t"
+            "pcmpeqb %%xmm1, %%xmm0\n\t"
+            "pmovmskb %%xmm0, %0"
+            : "=r"(mask)
+            : "r"(p1 + offset), "r"(p2 + offset)
+            : "xmm0", "xmm1");
+        if (mask != 0xFFFF) break;
+        offset += 16;
+    }
+    return offset;
+}
+
+static int cmp_sse2(const void *s1, const void *s2, size_t n) {
+    if (n < 32 || !kernel_simd_usable())
+        return cmp_word(s1, s2, n);
+
+    const uint8_t *p1 = (const uint8_t *)s1;
+    const uint8_t *p2 = (const uint8_t *)s2;
+    size_t offset = sse2_cmp_chunks(p1, p2, n >> 4);
+
+    return cmp_byte(p1 + offset, p2 + offset, n - offset);
+}
+
+/* ============================================================================
+ * DISPATCH
+ * ============================================================================ */
+
+const struct memops_variant memops_variants[] = {
+    { "byte", 0,                copy_byte, set_byte, cmp_byte },
+    { "word", 0,                copy_word, set_word, cmp_word },
+    { "rep",  0,                copy_rep,  set_rep,  cmp_word },
+    { "sse2", CPUID_EDX_SSE2,   copy_sse2, set_sse2, cmp_sse2 },
+};
+
+const int memops_variant_count = sizeof(memops_variants) / sizeof(memops_variants[0]);
+
+// Byte loops until memops_init has probed the CPU
+static const struct memops_variant *active = &memops_variants[0];
+
+int memops_variant_usable(const struct memops_variant *v) {
+    if (v->required_edx & CPUID_EDX_SSE2) return cpu.sse_enabled;
+    return 1;
+}
+
+const struct memops_variant *memops_active(void) {
+    return active;
+}
+
+void memops_init(void) {
+    for (int i = memops_variant_count - 1; i >= 0; i--) {
+        if (memops_variant_usable(&memops_variants[i])) {
+            active = &memops_variants[i];
+            break;
+        }
+    }
+    printf("memops: using %s routines\n", active->name);
+}
+
+// Sector buffers are usually 16-byte aligned; copy them with no head or tail work
+__attribute__((target("sse2")))
+static void copy_sector_sse2(void *dest, const void *src) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+    size_t blocks = 512 / 64;
+
+    asm volatile (
+        "1:\n\t"
+        "movdqa   (%1), %%xmm0\n\t"
+        "movdqa 16(%1), %%xmm1\n\t"
+        "movdqa 32(%1), %%xmm2\n\t"
+        "movdqa 48(%1), %%xmm3\n\t"
+        "movdqa %%xmm0,   (%0)\n\t"
+        "movdqa %%xmm1, 16(%0)\n\t"
+        "movdqa %%xmm2, 32(%0)\n\t"
+        "movdqa %%xmm3, 48(%0)\n\t"
+        "add $64, %0\n\t"
+        "add $64, %1\n\t"
+        "dec %2\n\t"
+        "jnz 1b"
+        : "+r"(d), "+r"(s), "+r"(blocks)
+        :
+        : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+}
+
+void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
+    if (n == 512 && !(((uintptr_t)dest | (uintptr_t)src) & 15) &&
+        active->copy == copy_sse2 && kernel_simd_usable()) {
+        copy_sector_sse2(dest, src);
+        return dest;
+    }
+    if (n < 16) return copy_byte(dest, src, n);
+    return active->copy(dest, src, n);
+}
+
+void *memset(void *s, int c, size_t n) {
+    if (n < 16) return set_byte(s, c, n);
+    return active->set(s, c, n);
+}
+
+void *memmove(void *dest, const void *src, size_t n) {
+    uint8_t *pdest = (uint8_t *)dest;
+    const uint8_t *psrc = (const uint8_t *)src;
+
+    // Forward copies never read a byte after overwriting it when dest < src
+    if (pdest <= psrc || pdest >= psrc + n)
+        return n < 16 ? copy_byte(dest, src, n) : active->copy(dest, src, n);
+
+    // Overlapping with dest above src: copy backwards, trailing bytes first
+    size_t bytes = n & 3;
+    while (bytes--) {
+        n--;
+        pdest[n] = psrc[n];
+    }
+    if (n) {
+        void *d = pdest + n - 4;
+        const void *s = psrc + n - 4;
+        size_t dwords = n >> 2;
+        // An IRQ taken with DF=1 would run every string op in its handler
+        // backwards, so the flag is never set with interrupts enabled
+        unsigned long flags = save_and_cli();
+        asm volatile ("std\n\trep movsl\n\tcld"
+                      : "+D"(d), "+S"(s), "+c"(dwords) : : "memory");
+        restore_flags(flags);
+    }
+    return dest;
+}
+
+int memcmp(const void *s1, const void *s2, size_t n) {
+    if (n < 16) return cmp_byte(s1, s2, n);
+    return active->cmp(s1, s2, n);
+}
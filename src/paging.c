@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <paging.h>
+#include <pmm.h>
+#include <cpu.h>
+#include <commands.h>
+#include <vga.h>
+
+static uint32_t page_directory[1024] __attribute__((aligned(4096)));
+static uint32_t low_page_table[1024] __attribute__((aligned(4096)));
+
+static uint8_t pat_enabled = 0;
+
+/*
+ * PAT entry 1 (PWT=1, PCD=0) is reprogrammed from write-through to
+ * write-combining; the other entries keep their power-on values.
+ */
+static void pat_init(void) {
+    uint64_t pat = ((uint64_t)PAT_WB)             |
+                   ((uint64_t)PAT_WC << 8)        |
+                   ((uint64_t)PAT_UC_MINUS << 16) |
+                   ((uint64_t)PAT_UC << 24)       |
+                   ((uint64_t)PAT_WB << 32)       |
+                   ((uint64_t)PAT_WT << 40)       |
+                   ((uint64_t)PAT_UC_MINUS << 48) |
+                   ((uint64_t)PAT_UC << 56);
+    wrmsr(MSR_IA32_PAT, pat);
+    pat_enabled = 1;
+}
+
+static uint32_t cache_bits(enum page_cache mode) {
+    switch (mode) {
+    case PAGE_CACHE_WC: return pat_enabled ? PTE_PWT : (PTE_PCD | PTE_PWT);
+    case PAGE_CACHE_UC: return PTE_PCD | PTE_PWT;
+    case PAGE_CACHE_WB:
+    default:            return 0;
+    }
+}
+
+// Back a 4 MB slot with a freshly allocated page table; used without PSE
+static int map_with_table(uint32_t base, uint32_t flags) {
+    uint32_t *table = alloc_pages(0);
+    if (!table) return -1;
+
+    for (uint32_t i = 0; i < 1024; i++)
+        table[i] = (base + i * PAGE_SIZE) | flags;
+    page_directory[base / LARGE_PAGE_SIZE] = (uint32_t)table | PTE_PRESENT | PTE_WRITE;
+    return 0;
+}
+
+void paging_init(void) {
+    int pse = cpu_has(CPUID_EDX_PSE);
+    uint32_t global = cpu_has(CPUID_EDX_PGE) ? PTE_GLOBAL : 0;
+
+    if (cpu_has(CPUID_EDX_PAT) && cpu_has(CPUID_EDX_MSR))
+        pat_init();
+
+    for (int i = 0; i < 1024; i++)
+        page_directory[i] = 0;
+
+    // Low 4 MB: 4 KB pages so the VGA window can get its own memory type.
+    // Page 0 stays unmapped to trap null pointer dereferences.
+    low_page_table[0] = 0;
+    for (uint32_t i = 1; i < 1024; i++)
+        low_page_table[i] = (i * PAGE_SIZE) | PTE_PRESENT | PTE_WRITE | global;
+    page_directory[0] = (uint32_t)low_page_table | PTE_PRESENT | PTE_WRITE;
+
+    // Kernel heap and page allocator memory: identity-mapped 4 MB pages
+    uint32_t ram_top = pmm_top();
+    uint32_t slot;
+    for (slot = 1; slot < 1024 && slot * LARGE_PAGE_SIZE < ram_top; slot++) {
+        uint32_t base = slot * LARGE_PAGE_SIZE;
+        if (pse) {
+            page_directory[slot] = base | PTE_PRESENT | PTE_WRITE | PDE_LARGE | global;
+        } else if (map_with_table(base, PTE_PRESENT | PTE_WRITE | global) != 0) {
+            printf("Paging: out of memory for page tables at 0x%x\n", base);
+            break;
+        }
+    }
+
+    // Above RAM lies device memory: uncached large pages, left unmapped without PSE
+    if (pse) {
+        for (; slot < 1024; slot++) {
+            page_directory[slot] = (slot * LARGE_PAGE_SIZE) | PTE_PRESENT | PTE_WRITE |
+                                   PDE_LARGE | PTE_PCD | PTE_PWT;
+        }
+    }
+
+    paging_set_cache(VGA_TEXT_BASE, VGA_TEXT_SIZE, PAGE_CACHE_WC);
+
+    uint32_t cr4 = read_cr4();
+    if (pse) cr4 |= CR4_PSE;
+    if (global) cr4 |= CR4_PGE;
+    write_cr4(cr4);
+
+    write_cr3((uint32_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+
+    printf("Paging: enabled, RAM to 0x%x with %s pages, PAT %s\n", ram_top,
+           pse ? "4 MB" : "4 KB", pat_enabled ? "on" : "off");
+}
+
+// Change the memory type of a range inside the 4 KB-mapped low region
+int paging_set_cache(uint32_t addr, uint32_t size, enum page_cache mode) {
+    if (addr + size > LOW_MAP_END || addr + size < addr) return -1;
+
+    uint32_t bits = cache_bits(mode);
+    for (uint32_t page = addr & ~(PAGE_SIZE - 1); page < addr + size; page += PAGE_SIZE) {
+        uint32_t *pte = &low_page_table[page / PAGE_SIZE];
+        if (!(*pte & PTE_PRESENT)) continue;
+        *pte = (*pte & ~(PTE_PWT | PTE_PCD | PTE_PAT)) | bits;
+        invlpg(page);
+    }
+    return 0;
+}
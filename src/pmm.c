@@ -0,0 +1,323 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pmm.h>
+#include <mem.h>
+#include <commands.h>
+#include <vga.h>
+
+extern uint8_t __kernel_end[];
+
+// Per-order free lists of buddy blocks
+static struct page *free_area[MAX_ORDER + 1];
+static uint32_t free_count[MAX_ORDER + 1];
+
+// Descriptor array covering page frames [base_pfn, end_pfn)
+static struct page *page_map = NULL;
+static uint32_t base_pfn = 0;
+static uint32_t end_pfn = 0;
+static uint32_t total_pages = 0;
+static uint32_t nr_free_pages = 0;
+
+// Blocks zeroed ahead of time by pmm_idle(), linked through their descriptors
+static struct page *zero_pool[ZERO_POOL_MAX_ORDER + 1];
+static uint32_t zero_pool_count[ZERO_POOL_MAX_ORDER + 1];
+static uint32_t zero_pool_hits = 0;
+static uint32_t zero_pool_misses = 0;
+
+static inline uint32_t page_to_pfn(const struct page *page) {
+    return base_pfn + (uint32_t)(page - page_map);
+}
+
+static inline struct page *pfn_to_page(uint32_t pfn) {
+    return &page_map[pfn - base_pfn];
+}
+
+struct page *virt_to_page(const void *addr) {
+    uint32_t pfn = (uint32_t)addr >> PAGE_SHIFT;
+    if (!page_map || pfn < base_pfn || pfn >= end_pfn) return NULL;
+    return pfn_to_page(pfn);
+}
+
+static void area_push(struct page *page, unsigned int order) {
+    page->flags = PG_FREE;
+    page->order = (uint8_t)order;
+    page->prev = NULL;
+    page->next = free_area[order];
+    if (free_area[order]) free_area[order]->prev = page;
+    free_area[order] = page;
+    free_count[order]++;
+}
+
+static void area_remove(struct page *page, unsigned int order) {
+    if (page->prev) page->prev->next = page->next;
+    else free_area[order] = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->flags = 0;
+    free_count[order]--;
+}
+
+// Return a block to the free areas, merging with its buddy while possible
+static void buddy_free(uint32_t pfn, unsigned int order) {
+    while (order < MAX_ORDER) {
+        uint32_t buddy_pfn = pfn ^ (1u << order);
+        if (buddy_pfn < base_pfn || buddy_pfn + (1u << order) > end_pfn) break;
+
+        struct page *buddy = pfn_to_page(buddy_pfn);
+        if (!(buddy->flags & PG_FREE) || buddy->order != order) break;
+
+        area_remove(buddy, order);
+        pfn &= ~(1u << order);
+        order++;
+    }
+
+    area_push(pfn_to_page(pfn), order);
+}
+
+// Seed a page-aligned run of frames as the largest aligned blocks that fit
+static void seed_range(uint32_t start_pfn, uint32_t stop_pfn) {
+    while (start_pfn < stop_pfn) {
+        unsigned int order = MAX_ORDER;
+        while (order > 0 && ((start_pfn & ((1u << order) - 1)) ||
+                             start_pfn + (1u << order) > stop_pfn))
+            order--;
+
+        for (uint32_t i = 0; i < (1u << order); i++)
+            pfn_to_page(start_pfn + i)->flags = 0;
+
+        buddy_free(start_pfn, order);
+        nr_free_pages += 1u << order;
+        start_pfn += 1u << order;
+    }
+}
+
+static int e820_usable_range(const struct e820_entry *e, uint32_t floor,
+                             uint32_t *start_pfn, uint32_t *stop_pfn) {
+    if (e->type != E820_USABLE || e->base >= 0x100000000ULL) return 0;
+
+    uint64_t top = e->base + e->length;
+    if (top > 0x100000000ULL) top = 0x100000000ULL;
+    uint64_t bottom = e->base < floor ? floor : e->base;
+    if (top <= bottom) return 0;
+
+    *start_pfn = (uint32_t)((bottom + PAGE_SIZE - 1) >> PAGE_SHIFT);
+    *stop_pfn = (uint32_t)(top >> PAGE_SHIFT);
+    return *stop_pfn > *start_pfn;
+}
+
+void pmm_init(void) {
+    struct e820_map *map = (struct e820_map *)E820_MAP_ADDR;
+    struct e820_entry fallback;
+
+    if (map->count == 0 || map->count > E820_MAX_ENTRIES) {
+        printf("PMM: no E820 map, assuming RAM up to 0x%x\n", PMM_FALLBACK_TOP);
+        fallback.base = 0x100000;
+        fallback.length = PMM_FALLBACK_TOP - 0x100000;
+        fallback.type = E820_USABLE;
+        fallback.acpi = 1;
+        pmm_init_map(&fallback, 1);
+        return;
+    }
+
+    pmm_init_map(map->entries, map->count);
+}
+
+void pmm_init_map(const struct e820_entry *entries, uint32_t count) {
+    uint32_t kernel_end = ((uint32_t)__kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    // Span of usable frames above the kernel image
+    uint32_t lo = 0xFFFFFFFF, hi = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t s, e;
+        printf("E820: 0x%x - 0x%x type %u\n", (uint32_t)entries[i].base,
+               (uint32_t)(entries[i].base + entries[i].length), entries[i].type);
+        if (!e820_usable_range(&entries[i], kernel_end, &s, &e)) continue;
+        if (s < lo) lo = s;
+        if (e > hi) hi = e;
+    }
+
+    if (hi <= lo) {
+        printf("PMM: no usable memory above the kernel\n");
+        return;
+    }
+
+    base_pfn = lo;
+    end_pfn = hi;
+    total_pages = end_pfn - base_pfn;
+
+    // The descriptor array lives in the first usable region large enough for it
+    uint32_t map_pages = (total_pages * sizeof(struct page) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint32_t map_pfn = 0;
+    for (uint32_t i = 0; i < count && !map_pfn; i++) {
+        uint32_t s, e;
+        if (e820_usable_range(&entries[i], kernel_end, &s, &e) && e - s > map_pages)
+            map_pfn = s;
+    }
+    if (!map_pfn) {
+        printf("PMM: no room for %u page descriptors\n", total_pages);
+        return;
+    }
+
+    page_map = (struct page *)(map_pfn << PAGE_SHIFT);
+    for (uint32_t i = 0; i < total_pages; i++) {
+        page_map[i].flags = PG_RESERVED;
+        page_map[i].order = 0;
+        page_map[i].slab_class = 0;
+        page_map[i].next = NULL;
+        page_map[i].prev = NULL;
+    }
+
+    for (int o = 0; o <= MAX_ORDER; o++) {
+        free_area[o] = NULL;
+        free_count[o] = 0;
+    }
+    for (int o = 0; o <= ZERO_POOL_MAX_ORDER; o++) {
+        zero_pool[o] = NULL;
+        zero_pool_count[o] = 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t s, e;
+        if (!e820_usable_range(&entries[i], kernel_end, &s, &e)) continue;
+        if (s == map_pfn) s += map_pages;
+        if (s < e) seed_range(s, e);
+    }
+
+    printf("PMM: %u KB free in frames 0x%x - 0x%x\n",
+           nr_free_pages * (PAGE_SIZE / 1024), base_pfn, end_pfn);
+}
+
+static void *buddy_alloc(unsigned int order) {
+    unsigned int o = order;
+    while (o <= MAX_ORDER && !free_area[o]) o++;
+    if (o > MAX_ORDER) return NULL;
+
+    struct page *page = free_area[o];
+    area_remove(page, o);
+
+    // Split down, handing the upper halves back to the smaller orders
+    while (o > order) {
+        o--;
+        area_push(page + (1u << o), o);
+    }
+
+    page->order = (uint8_t)order;
+    nr_free_pages -= 1u << order;
+
+    return (void *)(page_to_pfn(page) << PAGE_SHIFT);
+}
+
+// Give every pooled block back to the buddy lists; called under memory pressure
+static int zero_pool_drain(void) {
+    int drained = 0;
+
+    for (int o = 0; o <= ZERO_POOL_MAX_ORDER; o++) {
+        while (zero_pool[o]) {
+            struct page *page = zero_pool[o];
+            zero_pool[o] = page->next;
+            zero_pool_count[o]--;
+            page->flags = 0;
+            buddy_free(page_to_pfn(page), o);
+            nr_free_pages += 1u << o;
+            drained++;
+        }
+    }
+
+    return drained;
+}
+
+void *alloc_pages(unsigned int order) {
+    if (order > MAX_ORDER) return NULL;
+
+    unsigned long flags = save_and_cli();
+    void *addr = buddy_alloc(order);
+    if (!addr && zero_pool_drain())
+        addr = buddy_alloc(order);
+    restore_flags(flags);
+
+    return addr;
+}
+
+void *alloc_zeroed_pages(unsigned int order) {
+    if (order <= ZERO_POOL_MAX_ORDER) {
+        unsigned long flags = save_and_cli();
+        struct page *page = zero_pool[order];
+        if (page) {
+            zero_pool[order] = page->next;
+            zero_pool_count[order]--;
+            page->flags = 0;
+            zero_pool_hits++;
+        } else {
+            zero_pool_misses++;
+        }
+        restore_flags(flags);
+
+        if (page) return (void *)(page_to_pfn(page) << PAGE_SHIFT);
+    }
+
+    void *addr = alloc_pages(order);
+    if (addr) memset(addr, 0, PAGE_SIZE << order);
+    return addr;
+}
+
+// Top up one short order of the zero pool; run before halting in idle loops
+void pmm_idle(void) {
+    unsigned int order;
+    for (order = 0; order <= ZERO_POOL_MAX_ORDER; order++) {
+        if (zero_pool_count[order] < ZERO_POOL_DEPTH) break;
+    }
+    if (order > ZERO_POOL_MAX_ORDER) return;
+
+    unsigned long flags = save_and_cli();
+    void *addr = buddy_alloc(order);
+    restore_flags(flags);
+    if (!addr) return;
+
+    // Zero with interrupts enabled; the block is private until it is pooled
+    memset(addr, 0, PAGE_SIZE << order);
+
+    struct page *page = virt_to_page(addr);
+    flags = save_and_cli();
+    page->flags = PG_ZEROED;
+    page->next = zero_pool[order];
+    zero_pool[order] = page;
+    zero_pool_count[order]++;
+    restore_flags(flags);
+}
+
+void free_pages(void *addr, unsigned int order) {
+    struct page *page = virt_to_page(addr);
+    if (!page || ((uint32_t)addr & (PAGE_SIZE - 1)) || order > MAX_ORDER) {
+        printf("free_pages: bad block 0x%x order %u\n", (uint32_t)addr, order);
+        return;
+    }
+    if (page->flags & (PG_FREE | PG_RESERVED | PG_ZEROED)) {
+        printf("free_pages: 0x%x is not allocated\n", (uint32_t)addr);
+        return;
+    }
+
+    unsigned long flags = save_and_cli();
+    for (uint32_t i = 0; i < (1u << order); i++)
+        page[i].flags = 0;
+    buddy_free(page_to_pfn(page), order);
+    nr_free_pages += 1u << order;
+    restore_flags(flags);
+}
+
+// End of the highest page frame the allocator manages, saturated below 4 GB
+uint32_t pmm_top(void) {
+    if (end_pfn >= (0xFFFFFFFFu >> PAGE_SHIFT)) return 0xFFFFF000u;
+    return end_pfn << PAGE_SHIFT;
+}
+
+void pmm_get_stats(struct pmm_stats *out) {
+    unsigned long flags = save_and_cli();
+    out->total_pages = total_pages;
+    out->free_pages = nr_free_pages;
+    for (int o = 0; o <= MAX_ORDER; o++)
+        out->free_blocks[o] = free_count[o];
+    for (int o = 0; o <= ZERO_POOL_MAX_ORDER; o++)
+        out->zero_pool_blocks[o] = zero_pool_count[o];
+    out->zero_pool_hits = zero_pool_hits;
+    out->zero_pool_misses = zero_pool_misses;
+    restore_flags(flags);
+}
@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <slab.h>
+#include <pmm.h>
+#include <commands.h>
+#include <vga.h>
+
+static struct slab_class slab_classes[SLAB_CLASSES];
+
+static inline int size_to_class(size_t size) {
+    if (size <= SLAB_MIN_SIZE) return 0;
+    return (32 - __builtin_clz((uint32_t)size - 1)) - SLAB_MIN_SHIFT;
+}
+
+void slab_init(void) {
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab_classes[i].size = SLAB_MIN_SIZE << i;
+        slab_classes[i].pages = 0;
+        slab_classes[i].in_use = 0;
+        slab_classes[i].free = NULL;
+    }
+}
+
+// Take a fresh page from the page allocator and thread its objects onto the free list
+static int slab_refill(int cls) {
+    uint8_t *base = alloc_pages(0);
+    if (!base) return -1;
+
+    struct slab_class *sc = &slab_classes[cls];
+    struct page *page = virt_to_page(base);
+    uint32_t count = PAGE_SIZE / sc->size;
+
+    page->flags = PG_SLAB;
+    page->slab_class = (uint8_t)cls;
+
+    for (uint32_t i = count; i > 0; i--) {
+        struct slab_object *obj = (struct slab_object *)(base + (i - 1) * sc->size);
+        obj->next = sc->free;
+        sc->free = obj;
+    }
+
+    sc->pages++;
+    return 0;
+}
+
+void *slab_alloc(size_t size) {
+    if (size == 0 || size > SLAB_MAX_SIZE) return NULL;
+
+    int cls = size_to_class(size);
+    struct slab_class *sc = &slab_classes[cls];
+
+    unsigned long flags = save_and_cli();
+    if (!sc->free && slab_refill(cls) != 0) {
+        restore_flags(flags);
+        return NULL;
+    }
+
+    struct slab_object *obj = sc->free;
+    sc->free = obj->next;
+    sc->in_use++;
+    restore_flags(flags);
+
+    return obj;
+}
+
+int slab_owns(const void *ptr) {
+    struct page *page = virt_to_page(ptr);
+    return page && (page->flags & PG_SLAB);
+}
+
+size_t slab_size(const void *ptr) {
+    struct page *page = virt_to_page(ptr);
+    return slab_classes[page->slab_class].size;
+}
+
+void slab_get_stats(struct slab_class out[SLAB_CLASSES]) {
+    unsigned long flags = save_and_cli();
+    for (int i = 0; i < SLAB_CLASSES; i++)
+        out[i] = slab_classes[i];
+    restore_flags(flags);
+}
+
+void slab_free(void *ptr) {
+    struct page *page = virt_to_page(ptr);
+    if (!page || !(page->flags & PG_SLAB)) {
+        printf("slab_free: 0x%x is not in a slab page\n", (uint32_t)ptr);
+        return;
+    }
+
+    struct slab_class *sc = &slab_classes[page->slab_class];
+    if (((uint32_t)ptr & (PAGE_SIZE - 1)) % sc->size) {
+        printf("slab_free: 0x%x is not an object boundary\n", (uint32_t)ptr);
+        return;
+    }
+
+    struct slab_object *obj = (struct slab_object *)ptr;
+    unsigned long flags = save_and_cli();
+    obj->next = sc->free;
+    sc->free = obj;
+    sc->in_use--;
+    restore_flags(flags);
+}
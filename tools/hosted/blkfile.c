@@ -0,0 +1,80 @@
+// Hosted block device backend: a disk image file accessed with
+// pread/pwrite, with fdatasync as the cache flush.
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <blk.h>
+#include "blkfile.h"
+
+struct blkfile {
+    struct block_device dev;
+    int fd;
+    uint32_t sectors;
+};
+
+static int blkfile_read(struct block_device *dev, uint32_t lba, uint32_t count, void *buf) {
+    struct blkfile *bf = dev->private;
+    size_t bytes = (size_t)count * BLK_SECTOR_SIZE;
+
+    if (lba > bf->sectors || count > bf->sectors - lba) return -1;
+    return pread(bf->fd, buf, bytes, (off_t)lba * BLK_SECTOR_SIZE) == (ssize_t)bytes ? 0 : -1;
+}
+
+static int blkfile_write(struct block_device *dev, uint32_t lba, uint32_t count,
+                         const void *buf, uint32_t flags) {
+    struct blkfile *bf = dev->private;
+    size_t bytes = (size_t)count * BLK_SECTOR_SIZE;
+
+    if (lba > bf->sectors || count > bf->sectors - lba) return -1;
+    if (pwrite(bf->fd, buf, bytes, (off_t)lba * BLK_SECTOR_SIZE) != (ssize_t)bytes) return -1;
+    return (flags & BLK_FUA) ? fdatasync(bf->fd) : 0;
+}
+
+static int blkfile_flush(struct block_device *dev) {
+    return fdatasync(((struct blkfile *)dev->private)->fd);
+}
+
+static uint32_t blkfile_size(struct block_device *dev) {
+    return ((struct blkfile *)dev->private)->sectors;
+}
+
+static const struct block_device_ops blkfile_ops = {
+    .read = blkfile_read,
+    .write = blkfile_write,
+    .flush = blkfile_flush,
+    .size = blkfile_size,
+};
+
+// Open (or create, min_sectors long) an image file and register it
+int blkfile_open(uint8_t drive, const char *path, uint32_t min_sectors) {
+    struct blkfile *bf = calloc(1, sizeof(*bf));
+    struct stat st;
+
+    if (!bf) return -1;
+    if ((bf->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(bf->fd, &st) != 0)
+        goto fail;
+
+    if ((uint64_t)st.st_size < (uint64_t)min_sectors * BLK_SECTOR_SIZE) {
+        if (ftruncate(bf->fd, (off_t)min_sectors * BLK_SECTOR_SIZE) != 0) goto fail;
+        st.st_size = (off_t)min_sectors * BLK_SECTOR_SIZE;
+    }
+
+    bf->sectors = (uint32_t)(st.st_size / BLK_SECTOR_SIZE);
+    bf->dev = (struct block_device){
+        .name = "file",
+        .ops = &blkfile_ops,
+        .private = bf,
+        .channel = -1,
+        .max_sectors = bf->sectors,
+    };
+    if (blk_register(drive, &bf->dev) == 0) return 0;
+
+fail:
+    if (bf->fd >= 0) close(bf->fd);
+    free(bf);
+    return -1;
+}
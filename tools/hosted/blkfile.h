@@ -0,0 +1,8 @@
+#ifndef BLKFILE_H
+#define BLKFILE_H
+
+#include <stdint.h>
+
+int blkfile_open(uint8_t drive, const char *path, uint32_t min_sectors);
+
+#endif
@@ -0,0 +1,402 @@
+// Hosted filesystem and cache benchmark.
+//
+// Builds the block layer, buffer cache and Elixir as a normal Linux program
+// and runs the same workload over two block_device backends: a disk image
+// file (build/ide_drive.img by default) and a RAM disk. No emulated PIO is
+// involved, so the numbers are the cost of the filesystem and cache code
+// plus whatever the backend itself adds.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arena.h>
+#include <bench.h>
+#include <bcache.h>
+#include <blk.h>
+#include <fs/elixir.h>
+#include <mem.h>
+#include <pmm.h>
+#include "blkfile.h"
+
+#define HOSTED_RAM_SIZE     (128u << 20)
+#define FILE_DRIVE          1           // The drive the kernel formats at boot
+#define IMAGE_MIN_SECTORS   (64u << 11) // 64 MB when the image has to be created
+#define RAMDISK_SECTORS     (64u << 11)
+#define ALLOC_OPS           20000
+#define ALLOC_SLOTS         512
+#define SEQ_FILE_BYTES      (8u << 20)
+#define SEQ_CHUNK           (64u << 10)
+#define FRAG_APPENDS        1500
+#define SMALL_FILES         64
+#define SMALL_FIRST_INO     2           // After the root and dir_bench's directory
+#define SMALL_GROWN         3000
+
+static uint8_t ram[HOSTED_RAM_SIZE] __attribute__((aligned(1 << 22)));
+
+int hosted_quiet = 1;
+
+int hosted_printf(const char *format, ...) {
+    if (hosted_quiet) return 0;
+
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n;
+}
+
+void serial_printf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+uint64_t ktime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// No IDE drives are registered, so the request queue is never reached
+int blkq_submit(struct blk_request *req) {
+    (void)req;
+    return -1;
+}
+
+void blkq_wait(struct blk_request *req) {
+    (void)req;
+}
+
+void blkq_drain(uint8_t channel) {
+    (void)channel;
+}
+
+void blk_queue_get_stats(uint8_t channel, struct blk_queue_stats *out) {
+    (void)channel;
+    memset(out, 0, sizeof(*out));
+}
+
+static int hosted_boot(void) {
+    struct e820_entry entry = {
+        .base = (uintptr_t)ram,
+        .length = HOSTED_RAM_SIZE,
+        .type = E820_USABLE,
+        .acpi = 1,
+    };
+
+    if ((uintptr_t)ram + HOSTED_RAM_SIZE > 0xFFFFFFFFu) {
+        fprintf(stderr, "fsbench: RAM array above 4 GB, link with -no-pie\n");
+        return -1;
+    }
+
+    pmm_init_map(&entry, 1);
+    heap_init();
+    return 0;
+}
+
+/* ============================================================================
+ * WORKLOAD
+ * ============================================================================ */
+
+static uint32_t rng = 0x9E3779B9u;
+
+static uint32_t rnd(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint8_t chunk[SEQ_CHUNK], check[SEQ_CHUNK];
+
+static uint32_t index_extents(uint8_t drive, const struct index *in) {
+    uint32_t extents = 0;
+    for (uint32_t fb = 0, run; fb < in->blocks; fb += run) {
+        if (elixir_bmap(drive, in, fb, &run) == UINT32_MAX) return 0;
+        extents++;
+    }
+    return extents;
+}
+
+// A sequential file written and read back in large chunks, then two files
+// grown a block at a time in turn so that neither can extend its last
+// extent and both spill into extent blocks. Every mapping is checked
+// against a shadow copy and all blocks must come back on truncate.
+static int bench_files(const char *backend, uint8_t drive, struct super_block *sb) {
+    static uint32_t shadow[2][FRAG_APPENDS];
+    struct index seq, frag[2];
+    struct blk_stats b0, b1, b2;
+    uint32_t free_before = sb->s_free_blocks;
+
+    memset(&seq, 0, sizeof(seq));
+    memset(frag, 0, sizeof(frag));
+
+    blk_get_stats(drive, &b0);
+    uint64_t t0 = ktime_ns();
+    for (uint32_t off = 0; off < SEQ_FILE_BYTES; off += SEQ_CHUNK) {
+        for (uint32_t i = 0; i < SEQ_CHUNK; i++) chunk[i] = (uint8_t)(off / SEQ_CHUNK * 31 + i);
+        if (elixir_file_write(drive, &seq, off, chunk, SEQ_CHUNK) != (int)SEQ_CHUNK) return -1;
+    }
+    if (bcache_writeback(drive) != 0) return -1;
+    blk_get_stats(drive, &b1);
+
+    uint64_t t1 = ktime_ns();
+    for (uint32_t off = 0; off < SEQ_FILE_BYTES; off += SEQ_CHUNK) {
+        if (elixir_file_read(drive, &seq, off, check, SEQ_CHUNK) != (int)SEQ_CHUNK) return -1;
+        for (uint32_t i = 0; i < SEQ_CHUNK; i++) {
+            if (check[i] != (uint8_t)(off / SEQ_CHUNK * 31 + i)) {
+                fprintf(stderr, "fsbench: %s file data differs at %u\n", backend, off + i);
+                return -1;
+            }
+        }
+    }
+    uint64_t t2 = ktime_ns();
+    blk_get_stats(drive, &b2);
+
+    for (uint32_t i = 0; i < FRAG_APPENDS; i++) {
+        for (int f = 0; f < 2; f++) {
+            if (elixir_extend(drive, &frag[f], 1) != 0) return -1;
+            shadow[f][i] = elixir_bmap(drive, &frag[f], i, NULL);
+        }
+    }
+    for (int f = 0; f < 2; f++) {
+        for (uint32_t i = 0; i < FRAG_APPENDS; i++) {
+            uint32_t run;
+            if (elixir_bmap(drive, &frag[f], i, &run) != shadow[f][i] || run == 0) {
+                fprintf(stderr, "fsbench: %s extent lookup of block %u wrong\n", backend, i);
+                return -1;
+            }
+        }
+    }
+
+    uint32_t seq_extents = index_extents(drive, &seq);
+    uint32_t frag_extents = index_extents(drive, &frag[0]);
+    uint8_t frag_depth = frag[0].depth;
+
+    // Shrinking part way keeps the tree consistent, to zero frees it all
+    if (elixir_file_truncate(drive, &frag[0], FRAG_APPENDS / 3 * sb->s_block_size) != 0 ||
+        elixir_bmap(drive, &frag[0], FRAG_APPENDS / 3 - 1, NULL) != shadow[0][FRAG_APPENDS / 3 - 1] ||
+        elixir_file_truncate(drive, &frag[0], 0) != 0 ||
+        elixir_file_truncate(drive, &frag[1], 0) != 0 ||
+        elixir_file_truncate(drive, &seq, 0) != 0)
+        return -1;
+    if (sb->s_free_blocks != free_before || frag[0].depth || frag[1].depth) {
+        fprintf(stderr, "fsbench: %s truncate left %u blocks allocated\n",
+                backend, free_before - sb->s_free_blocks);
+        return -1;
+    }
+
+    printf("backend=%s file_mb=%u write_mb_s=%llu read_mb_s=%llu seq_extents=%u "
+           "write_cmds=%u read_cmds=%u frag_extents=%u frag_depth=%u\n",
+           backend, SEQ_FILE_BYTES >> 20,
+           (unsigned long long)SEQ_FILE_BYTES * 1000 / (t1 - t0 + 1),
+           (unsigned long long)SEQ_FILE_BYTES * 1000 / (t2 - t1 + 1),
+           seq_extents, b1.writes - b0.writes, b2.reads - b1.reads,
+           frag_extents, (unsigned)frag_depth);
+    return 0;
+}
+
+static uint8_t small_byte(uint32_t ino, uint32_t i) {
+    return (uint8_t)(ino * 7 + i * 13);
+}
+
+static int small_check(uint8_t drive, uint32_t ino, const struct index *in, uint32_t size) {
+    if (in->size != size || elixir_file_read(drive, in, 0, check, size) != (int)size) return -1;
+    for (uint32_t i = 0; i < size; i++)
+        if (check[i] != small_byte(ino, i)) return -1;
+    return 0;
+}
+
+// Small files live in their index sectors and take no blocks. One of them
+// grows past the inline limit, which moves it to extents, and is
+// truncated back, which returns its blocks.
+static int bench_small(const char *backend, uint8_t drive, struct super_block *sb) {
+    static uint32_t sizes[SMALL_FILES];
+    uint32_t free_before = sb->s_free_blocks;
+    struct index in;
+
+    uint64_t t0 = ktime_ns();
+    for (uint32_t ino = 0; ino < SMALL_FILES; ino++) {
+        sizes[ino] = 1 + rnd() % ELIXIR_INLINE_DATA;
+        for (uint32_t i = 0; i < sizes[ino]; i++) chunk[i] = small_byte(ino, i);
+
+        memset(&in, 0, sizeof(in));
+        // Two writes, the second extending the first
+        uint32_t half = sizes[ino] / 2;
+        if (elixir_file_write(drive, &in, 0, chunk, half) != (int)half ||
+            elixir_file_write(drive, &in, half, chunk + half, sizes[ino] - half) != (int)(sizes[ino] - half) ||
+            elixir_write_index(drive, SMALL_FIRST_INO + ino, &in) != 0)
+            return -1;
+    }
+    uint64_t t1 = ktime_ns();
+
+    uint32_t inline_files = 0;
+    for (uint32_t ino = 0; ino < SMALL_FILES; ino++) {
+        if (elixir_read_index(drive, SMALL_FIRST_INO + ino, &in) != 0 || small_check(drive, ino, &in, sizes[ino]) != 0) {
+            fprintf(stderr, "fsbench: %s small file %u reads back wrong\n", backend, ino);
+            return -1;
+        }
+        if ((in.flags & ELIXIR_INDEX_INLINE) && !in.blocks) inline_files++;
+    }
+    uint64_t t2 = ktime_ns();
+    uint32_t used = free_before - sb->s_free_blocks;
+
+    for (uint32_t i = 0; i < SMALL_GROWN; i++) chunk[i] = small_byte(0, i);
+    if (elixir_read_index(drive, SMALL_FIRST_INO, &in) != 0 ||
+        elixir_file_write(drive, &in, sizes[0], chunk + sizes[0], SMALL_GROWN - sizes[0]) !=
+            (int)(SMALL_GROWN - sizes[0]) ||
+        (in.flags & ELIXIR_INDEX_INLINE) || small_check(drive, 0, &in, SMALL_GROWN) != 0 ||
+        elixir_file_truncate(drive, &in, 100) != 0 ||
+        !(in.flags & ELIXIR_INDEX_INLINE) || small_check(drive, 0, &in, 100) != 0 ||
+        sb->s_free_blocks != free_before) {
+        fprintf(stderr, "fsbench: %s inline file promotion failed\n", backend);
+        return -1;
+    }
+
+    printf("backend=%s small_files=%u inline=%u blocks_used=%u write_ns_per_file=%llu read_ns_per_file=%llu\n",
+           backend, SMALL_FILES, inline_files, used,
+           (unsigned long long)(t1 - t0) / SMALL_FILES, (unsigned long long)(t2 - t1) / SMALL_FILES);
+    return 0;
+}
+
+static int bench_drive(const char *backend, uint8_t drive) {
+    static struct { uint32_t start, n; } slots[ALLOC_SLOTS];
+    struct bcache_stats before, after;
+    struct blk_stats bs;
+    uint32_t failed = 0;
+
+    memset(slots, 0, sizeof(slots));
+    bcache_get_stats(&before);
+
+    uint64_t t0 = ktime_ns();
+    if (elixir_format(drive) != 0) {
+        fprintf(stderr, "fsbench: format of %s failed\n", backend);
+        return -1;
+    }
+
+    uint64_t t1 = ktime_ns();
+    struct arena *arena = arena_create(ARENA_DEFAULT_ORDER);
+    if (!arena || elixir_mount(arena, drive, NULL) != 0) {
+        fprintf(stderr, "fsbench: mount of %s failed\n", backend);
+        return -1;
+    }
+
+    // Random extent churn: allocations near the previous extent, random frees
+    uint64_t t2 = ktime_ns();
+    uint32_t hint = 0;
+    for (uint32_t op = 0; op < ALLOC_OPS; op++) {
+        uint32_t i = rnd() % ALLOC_SLOTS;
+        if (slots[i].n) {
+            free_extent(drive, slots[i].start, slots[i].n);
+            slots[i].n = 0;
+            continue;
+        }
+
+        uint32_t n = 1 + rnd() % ((rnd() & 7) ? 8 : 256);
+        uint32_t start = alloc_extent(drive, n, hint);
+        if (start == UINT32_MAX) {
+            failed++;
+            continue;
+        }
+        slots[i].start = start;
+        slots[i].n = n;
+        hint = start + n;
+    }
+
+    uint64_t t3 = ktime_ns();
+    if (bcache_sync(drive) != 0) {
+        fprintf(stderr, "fsbench: sync of %s failed\n", backend);
+        return -1;
+    }
+    uint64_t t4 = ktime_ns();
+
+    // A clean remount reads the superblock alone; its free count must agree
+    // with the bitmap
+    struct super_block *sb;
+    struct block_bitmap *bb;
+    if (elixir_unmount(drive) != 0) {
+        fprintf(stderr, "fsbench: unmount of %s failed\n", backend);
+        return -1;
+    }
+    uint64_t t5 = ktime_ns();
+    if (elixir_mount(arena, drive, &sb) != 0) {
+        fprintf(stderr, "fsbench: remount of %s failed\n", backend);
+        return -1;
+    }
+    uint64_t t6 = ktime_ns();
+    if (elixir_read_bitmap(arena, drive, sb, &bb) != 0 || bb->free_count != sb->s_free_blocks) {
+        fprintf(stderr, "fsbench: %s superblock says %u free blocks, bitmap disagrees\n",
+                backend, sb->s_free_blocks);
+        return -1;
+    }
+    uint32_t free_blocks = sb->s_free_blocks;
+
+    // Writeback cost of one small allocation: the dirty bitmap sector and
+    // the superblock
+    struct blk_stats small_before, small_after;
+    blk_get_stats(drive, &small_before);
+    uint32_t small = alloc_extent(drive, 1, 0);
+    if (small == UINT32_MAX || bcache_writeback(drive) != 0) {
+        fprintf(stderr, "fsbench: small allocation on %s failed\n", backend);
+        return -1;
+    }
+    blk_get_stats(drive, &small_after);
+    free_extent(drive, small, 1);
+
+    if (bench_files(backend, drive, sb) != 0 || bench_small(backend, drive, sb) != 0 ||
+        dir_bench(drive) != 0) {
+        fprintf(stderr, "fsbench: file workload on %s failed\n", backend);
+        return -1;
+    }
+    elixir_unmount(drive);
+    arena_destroy(arena);
+
+    bcache_get_stats(&after);
+    blk_get_stats(drive, &bs);
+
+    printf("backend=%s format_us=%llu mount_us=%llu alloc_ns_per_op=%llu alloc_failed=%u "
+           "sync_us=%llu remount_us=%llu free_blocks=%u small_alloc_writes=%u small_alloc_sectors=%u cache_hits=%u cache_misses=%u writebacks=%u "
+           "blk_reads=%u blk_writes=%u sectors_written=%u flushes=%u\n",
+           backend,
+           (unsigned long long)(t1 - t0) / 1000, (unsigned long long)(t2 - t1) / 1000,
+           (unsigned long long)(t3 - t2) / ALLOC_OPS, failed,
+           (unsigned long long)(t4 - t3) / 1000, (unsigned long long)(t6 - t5) / 1000,
+           free_blocks, small_after.writes - small_before.writes,
+           small_after.sectors_written - small_before.sectors_written,
+           after.hits - before.hits, after.misses - before.misses,
+           after.writebacks - before.writebacks,
+           bs.reads, bs.writes, bs.sectors_written, bs.flushes);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *image = "build/ide_drive.img";
+    int failures = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) hosted_quiet = 0;
+        else image = argv[i];
+    }
+
+    if (hosted_boot() != 0) return 1;
+
+    if (blkfile_open(FILE_DRIVE, image, IMAGE_MIN_SECTORS) != 0) {
+        fprintf(stderr, "fsbench: cannot open %s\n", image);
+        failures++;
+    } else if (bench_drive("file", FILE_DRIVE) != 0) {
+        failures++;
+    }
+
+    if (ramdisk_create(BLK_RAMDISK_DRIVE, RAMDISK_SECTORS) != 0 ||
+        bench_drive("ram", BLK_RAMDISK_DRIVE) != 0)
+        failures++;
+
+    bcache_dump_stats();
+    printf("fsbench: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,361 @@
+// Hosted allocator test and benchmark.
+//
+// Builds src/mem.c, src/slab.c, src/pmm.c and src/heap_profile.c as a normal
+// Linux program on top of a static "RAM" array and replays randomized
+// allocation traces against each heap policy.  Every trace runs twice in a
+// fresh child process: once timed with nothing else in the loop, once with
+// pattern fills, heap_check() walks and fragmentation sampling.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <mem.h>
+#include <pmm.h>
+
+#define HOSTED_RAM_SIZE     (64u << 20)
+#define TRACE_OPS           200000
+#define TRACE_SLOTS         4096
+#define CHECK_INTERVAL      1024
+
+static uint8_t ram[HOSTED_RAM_SIZE] __attribute__((aligned(1 << 22)));
+
+int hosted_quiet = 1;
+
+int hosted_printf(const char *format, ...) {
+    if (hosted_quiet) return 0;
+
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n;
+}
+
+void serial_printf(const char *fmt, ...) {
+    if (hosted_quiet) return;
+
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+/* ============================================================================
+ * TRACES
+ * ============================================================================ */
+
+struct slot {
+    uint8_t *ptr;
+    uint32_t size;
+};
+
+struct sim {
+    uint32_t rng;
+    struct slot slots[TRACE_SLOTS];
+    uint32_t phase;
+    uint32_t step;
+    uint32_t top;
+};
+
+// One trace step: pick a slot and either free it (size 0) or allocate 'size'
+// bytes into it.  zero selects kzalloc over kmalloc.
+struct op {
+    uint32_t slot;
+    uint32_t size;
+    int zero;
+};
+
+static uint32_t rnd(struct sim *s) {
+    s->rng ^= s->rng << 13;
+    s->rng ^= s->rng >> 17;
+    s->rng ^= s->rng << 5;
+    return s->rng;
+}
+
+// Log-uniform size between 2^lo and 2^hi bytes
+static uint32_t rnd_size(struct sim *s, unsigned int lo, unsigned int hi) {
+    uint32_t shift = lo + rnd(s) % (hi - lo);
+    return (1u << shift) + rnd(s) % (1u << shift);
+}
+
+// Steady state: a fixed working set churned at random, roughly half full
+static void trace_steady(struct sim *s, struct op *op) {
+    op->slot = rnd(s) % 1024;
+    op->size = s->slots[op->slot].ptr ? 0 : rnd_size(s, 4, 15);
+    op->zero = 0;
+}
+
+// Bursts of allocations released mostly in random order, with a few
+// long-lived survivors pinning the middle of the heap
+static void trace_bursty(struct sim *s, struct op *op) {
+    op->zero = 0;
+
+    if (s->phase == 0) {
+        op->slot = s->step++;
+        op->size = s->slots[op->slot].ptr ? 0 : rnd_size(s, 6, 13);
+        if (s->step == TRACE_SLOTS) {
+            s->phase = 1;
+            s->step = 0;
+        }
+        return;
+    }
+
+    op->slot = rnd(s) % TRACE_SLOTS;
+    op->size = 0;
+    if (++s->step == TRACE_SLOTS - TRACE_SLOTS / 10) {
+        s->phase = 0;
+        s->step = 0;
+    }
+    if (!s->slots[op->slot].ptr || op->slot % 10 == 0) {
+        // Survivor or already empty: reuse the step as a small allocation
+        op->size = s->slots[op->slot].ptr ? 0 : rnd_size(s, 4, 8);
+    }
+}
+
+// Filesystem-shaped: mount-sized structures (super block, bitmap header,
+// whole-disk bitmap), then runs of sector buffers released newest first
+static void trace_fs(struct sim *s, struct op *op) {
+    static const uint32_t mount_sizes[] = { 512, 16, 25600, 512 };
+    const uint32_t mount_count = sizeof(mount_sizes) / sizeof(mount_sizes[0]);
+
+    op->zero = 0;
+
+    if (s->phase == 0) {
+        op->slot = s->step;
+        op->size = mount_sizes[s->step];
+        op->zero = op->size >= PAGE_SIZE;
+        if (++s->step == mount_count) {
+            s->phase = 1;
+            s->top = mount_count;
+        }
+        return;
+    }
+
+    // Grow or shrink the stack of sector buffers
+    if (s->top < TRACE_SLOTS && (s->top == mount_count || rnd(s) % 8 < 5)) {
+        op->slot = s->top++;
+        op->size = 512 * (1 + rnd(s) % ((rnd(s) & 7) ? 8 : 128));
+        return;
+    }
+
+    op->slot = --s->top;
+    op->size = 0;
+
+    // Occasionally unmount and remount everything
+    if (s->top == mount_count && rnd(s) % 16 == 0) {
+        s->phase = 2;
+        s->step = 0;
+    }
+    if (s->phase == 2) {
+        op->slot = s->step;
+        if (++s->step == mount_count) {
+            s->phase = 0;
+            s->step = 0;
+        }
+        s->top = mount_count;
+    }
+}
+
+struct trace {
+    const char *name;
+    void (*next)(struct sim *s, struct op *op);
+};
+
+static const struct trace traces[] = {
+    { "steady", trace_steady },
+    { "bursty", trace_bursty },
+    { "fs",     trace_fs },
+};
+
+static const char *const policy_names[] = { "first", "next", "best" };
+
+/* ============================================================================
+ * RUNNER
+ * ============================================================================ */
+
+struct result {
+    uint64_t ns;
+    uint32_t ops;
+    uint32_t failed;
+    uint32_t peak_frag;
+    uint32_t errors;
+    struct heap_stats stats;
+};
+
+static int hosted_boot(enum heap_policy policy) {
+    struct e820_entry entry = {
+        .base = (uintptr_t)ram,
+        .length = HOSTED_RAM_SIZE,
+        .type = E820_USABLE,
+        .acpi = 1,
+    };
+
+    if ((uintptr_t)ram + HOSTED_RAM_SIZE > 0xFFFFFFFFu) {
+        fprintf(stderr, "heapbench: RAM array above 4 GB, link with -no-pie\n");
+        return -1;
+    }
+
+    pmm_init_map(&entry, 1);
+    heap_init();
+    heap_set_policy(policy);
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int check_slot(const struct slot *slot, uint32_t index) {
+    uint8_t fill = (uint8_t)(index * 31 + 7);
+    for (uint32_t i = 0; i < slot->size; i++) {
+        if (slot->ptr[i] != fill) {
+            fprintf(stderr, "slot %u: %u-byte block at %p overwritten at +%u\n",
+                    index, slot->size, (void *)slot->ptr, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void run(const struct trace *trace, int checked, struct result *res) {
+    static struct sim sim;
+    struct op op;
+
+    memset(&sim, 0, sizeof(sim));
+    memset(res, 0, sizeof(*res));
+    sim.rng = 0x9E3779B9u;
+
+    uint64_t start = now_ns();
+    for (uint32_t n = 0; n < TRACE_OPS; n++) {
+        trace->next(&sim, &op);
+        struct slot *slot = &sim.slots[op.slot];
+
+        if (op.size == 0) {
+            if (!slot->ptr) continue;
+            if (checked) res->errors += check_slot(slot, op.slot);
+            kfree(slot->ptr);
+            slot->ptr = NULL;
+        } else {
+            if (slot->ptr) continue;
+            slot->ptr = op.zero ? kzalloc(op.size) : kmalloc(op.size);
+            slot->size = op.size;
+            if (!slot->ptr) {
+                res->failed++;
+                continue;
+            }
+            if (checked) {
+                if ((uintptr_t)slot->ptr & 7) {
+                    fprintf(stderr, "%p is not 8-byte aligned\n", (void *)slot->ptr);
+                    res->errors++;
+                }
+                if (ksize(slot->ptr) < op.size) {
+                    fprintf(stderr, "ksize(%p) = %zu < %u\n",
+                            (void *)slot->ptr, ksize(slot->ptr), op.size);
+                    res->errors++;
+                }
+                if (op.zero) {
+                    for (uint32_t i = 0; i < op.size; i++) {
+                        if (slot->ptr[i]) {
+                            fprintf(stderr, "kzalloc(%u) byte %u not zero\n", op.size, i);
+                            res->errors++;
+                            break;
+                        }
+                    }
+                }
+                memset(slot->ptr, (uint8_t)(op.slot * 31 + 7), op.size);
+            }
+        }
+        res->ops++;
+
+        if (checked && n % CHECK_INTERVAL == 0) {
+            struct heap_stats stats;
+            res->errors += heap_check();
+            heap_get_stats(&stats);
+            if (stats.frag_permille > res->peak_frag) res->peak_frag = stats.frag_permille;
+        }
+    }
+    res->ns = now_ns() - start;
+
+    if (!checked) return;
+
+    // Drain: every region must coalesce back into a single free block
+    for (uint32_t i = 0; i < TRACE_SLOTS; i++) {
+        if (!sim.slots[i].ptr) continue;
+        res->errors += check_slot(&sim.slots[i], i);
+        kfree(sim.slots[i].ptr);
+    }
+    res->errors += heap_check();
+    heap_get_stats(&res->stats);
+    if (res->stats.free_blocks != res->stats.grows) {
+        fprintf(stderr, "%u free blocks left in %u regions after drain\n",
+                res->stats.free_blocks, res->stats.grows);
+        res->errors++;
+    }
+}
+
+// Run one trace in a fresh child so every pass starts from an empty heap
+static int run_child(const struct trace *trace, enum heap_policy policy,
+                     int checked, struct result *res) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        close(fds[0]);
+        if (hosted_boot(policy) != 0) _exit(1);
+        run(trace, checked, res);
+        ssize_t n = write(fds[1], res, sizeof(*res));
+        _exit(n == (ssize_t)sizeof(*res) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (n != (ssize_t)sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "heapbench: %s/%s child died\n", trace->name, policy_names[policy]);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int failures = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) hosted_quiet = 0;
+
+    for (size_t t = 0; t < sizeof(traces) / sizeof(traces[0]); t++) {
+        for (int p = HEAP_FIRST_FIT; p <= HEAP_BEST_FIT; p++) {
+            struct result timed, checked;
+
+            if (run_child(&traces[t], p, 0, &timed) != 0 ||
+                run_child(&traces[t], p, 1, &checked) != 0) {
+                failures++;
+                continue;
+            }
+
+            printf("trace=%s policy=%s ops=%u ns_per_op=%llu.%02llu failed=%u "
+                   "peak_frag_permille=%u grows=%u search_steps=%u errors=%u\n",
+                   traces[t].name, policy_names[p], timed.ops,
+                   (unsigned long long)(timed.ns / timed.ops),
+                   (unsigned long long)(timed.ns * 100 / timed.ops % 100),
+                   timed.failed, checked.peak_frag, checked.stats.grows,
+                   checked.stats.search_steps, checked.errors);
+            if (checked.errors) failures++;
+        }
+    }
+
+    printf("heapbench: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+// Hosted stand-in for includes/commands.h: there are no interrupts to mask
+// in a user process, so the critical-section helpers only fence the compiler.
+
+#include <stdint.h>
+
+static inline unsigned long save_and_cli(void) {
+    asm volatile ("" ::: "memory");
+    return 0;
+}
+
+static inline void restore_flags(unsigned long flags) {
+    (void)flags;
+    asm volatile ("" ::: "memory");
+}
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+// Hosted stand-in for includes/serial.h: COM1 output goes to stdout.
+
+void serial_printf(const char *fmt, ...);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef VGA_H
+#define VGA_H
+
+// Hosted stand-in for includes/vga.h: kernel messages go to stdout unless
+// the harness silences them.
+
+extern int hosted_quiet;
+
+int hosted_printf(const char *format, ...);
+#define printf hosted_printf
+
+#endif